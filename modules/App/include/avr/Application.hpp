@@ -2,8 +2,10 @@
 #define AVR_APPLICATION_HPP
 
 #include <atomic>
+#include <utility>
 
 #include <avr/core/Core.hpp>
+#include <avr/core/Profiler.hpp>
 #include <avr/view/Window.hpp>
 #include <avr/camera/Camera.hpp>
 #include <avr/track/Tracking.hpp>
@@ -22,8 +24,8 @@ public:
     */
    class Builder : avr::Builder<Application> {
    public:
-      Builder() : avr::Builder<Application>(), cam(nullptr), path(""), label("AVR Application"), methods(nullptr) {/* ctor */}
-      ~Builder() { cam = nullptr; path.clear(); label.clear(); methods = nullptr; markers.clear(); }
+      Builder() : avr::Builder<Application>(), cam(nullptr), path(""), label("AVR Application"), methods(nullptr), pipelined(false), async(false), traceSeconds(10.0) {/* ctor */}
+      ~Builder() { cam = nullptr; path.clear(); label.clear(); methods = nullptr; markers.clear(); objects.clear(); databases.clear(); }
 
       //! sets the avr::Camera object
       Builder& camera(const Camera& cam) {
@@ -55,11 +57,52 @@ public:
          this->markers.push_back(PreMarker(path, model));
          return * this;
       }
+      //! prepares a marker given its image path and the .obj file of its renderer model, the model is loaded on build
+      Builder& marker(const std::string& path, const std::string& obj) {
+         this->objects.push_back(std::make_pair(path, obj));
+         return * this;
+      }
+      //! string literals would be ambiguous with the SPtr<Model>'s conversion constructor
+      Builder& marker(const std::string& path, const char* obj) {
+         return this->marker(path, std::string(obj));
+      }
+      //! adds all markers of a database file (see avr::MarkerFile) with the same renderer model
+      Builder& database(const std::string& path, const SPtr<Model> model) {
+         this->databases.push_back(PreMarker(path, model));
+         return * this;
+      }
       //! [optional] sets a video file path (if it does not set then uses the web cam)
       Builder& video(const std::string& path) {
          this->path = path;
          return * this;
       }
+      /**
+       * [optional] enables the pipelined execution: the capture, the vision and the render run in their own threads,
+       * connected by bounded queues, so the throughput is limited by the slowest stage instead of the sum of all stages.
+       * The frames are shown with a latency of a few frames (default is disabled)
+       */
+      Builder& pipeline(bool enable = true) {
+         this->pipelined = enable;
+         return * this;
+      }
+      /**
+       * [optional] enables the asynchronous localization: the lost markers are searched on a worker thread while the found
+       * ones keep being tracked, so the detection does not drop the frame rate (default is disabled)
+       */
+      Builder& asynchronous(bool enable = true) {
+         this->async = enable;
+         return * this;
+      }
+      /**
+       * [optional] records a Chrome trace (chrome://tracing or Perfetto) of the pipeline stages, it is written to the path on
+       * Stop or by Application::WriteTrace, keeping only the last given seconds. The environment variables AVR_TRACE (path)
+       * and AVR_TRACE_SECONDS enable it too (default is disabled)
+       */
+      Builder& trace(const std::string& path, double seconds = 10.0) {
+         this->tracePath = path;
+         this->traceSeconds = seconds;
+         return * this;
+      }
       //! [optional] sets an application's name that will appear as a window's title
       Builder& name(const std::string& label) {
          this->label = label;
@@ -67,8 +110,9 @@ public:
       }
       //! @overwrite
       //! @brief builds a new avr::Application instance
+      //! @note The markers, the models and the video capture are prepared concurrently
       SPtr<Application> build() const {
-         if(!cam or !methods or markers.size() < 1)
+         if(!cam or !methods or (markers.size() < 1 and objects.size() < 1 and databases.size() < 1))
             AVR_ERROR(Cod::Undefined, "missing some configurations");
          return new Application(*this);
       }
@@ -79,6 +123,12 @@ public:
       std::string label;
       SystemAlgorithms* methods;
       std::vector<PreMarker> markers;
+      std::vector<std::pair<std::string, std::string> > objects;   // marker image and model file
+      std::vector<PreMarker> databases;
+      bool pipelined;
+      bool async;
+      std::string tracePath;
+      double traceSeconds;
 
       friend class Application;
    };
@@ -102,6 +152,11 @@ public:
    //! takes a screenshot of the application @return the screen image
    cv::Mat Screenshot();
 
+   //! @return The timings and counters of the instrumented stages, it is empty unless the modules are built with AVR_PROFILE
+   std::vector<ProbeStats> Stats() const;
+   //! writes the recorded trace now, see Builder::trace @return false if it was not written
+   bool WriteTrace(const std::string& path) const;
+
 private:
    Application(const Builder&);
 
@@ -111,6 +166,8 @@ private:
 
    size_t id;
    SPtr<AppRenderer> app;
+   std::string tracePath;
+   bool started;           // Start was called and Stop was not, a failed stage also stops the renderer's run
 };
 
 } // namespace avr
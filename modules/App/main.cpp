@@ -41,11 +41,6 @@ public:
 };
 
 int main() {
-   // configure the augmentation model
-   SPtr<Model> model = FactoryModel::OBJ("../data/obj/f-16.obj");
-   model->ComputeFacetNormals();
-   model->ComputeVertexNormals();
-
    SystemAlgorithms sift = SystemAlgorithms(new SIFTDetector(1000), new SIFTExtractor, new BruteForceMatcher(cv::NORM_L2), new LucasKanadeAlgorithm);
 //   SystemAlgorithms surf = SystemAlgorithms(new SURFDetector, new SURFExtractor, new BruteForceMatcher(cv::NORM_L2), new LucasKanadeAlgorithm);
 //   SystemAlgorithms orb  = SystemAlgorithms(new ORBDetector, new ORBExtractor, new BruteForceMatcher(cv::NORM_HAMMING), new LucasKanadeAlgorithm);
@@ -58,17 +53,20 @@ int main() {
                // define o arquivo de configurao da cmera
                .camera("../data/camera.yml")
                // define a imagem do marcador e o renderer associado
-               .marker("../data/cormem_object.jpg", model)
+               .marker("../data/cormem_object.jpg", "../data/obj/f-16.obj")
                // habilita modos de otimizao na ordem performance, qualidade
                // se ambas flags so definidas, faz-se otimizao de balanceamento
 //               .optimize(false, true)
                .algorithms(sift)
+               // executa captura, viso e renderizao em threads separadas
+//               .pipeline()
+               // procura os marcadores perdidos em segundo plano
+//               .asynchronous()
+               // grava um trace das etapas (chrome://tracing) ao parar a aplicao
+//               .trace("avr_trace.json")
                // constroi a aplicao
                .build();
 
-   // compiles and saves the model's in graphic card memory (optimazes rendering)
-   model->Compile();
-
    // set event listeners
    app->AddListener(new Keyboard(app));
    // starts the application
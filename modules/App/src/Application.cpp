@@ -7,9 +7,20 @@
 
 #include <GL/glext.h>
 
+#include <avr/core/ThreadPool.hpp>
+#include <avr/core/RingQueue.hpp>
+#include <avr/core/Trace.hpp>
+
+#include <map>
+#include <set>
 #include <ctime>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <algorithm>
 #include <chrono>
 #include <sstream>
+#include <cstdlib>
 
 namespace avr {
 
@@ -19,20 +30,71 @@ using std::string;
 
 class Application::AppRenderer : public avr::Renderer {
 public:
-   AppRenderer(const SPtr<Camera>& cam, const SystemAlgorithms& methods, const vector<PreMarker>& setup, const std::string& video)
-   : id(0), frame(), cap(), cam(cam), markers(), run(false), pause(false), count(0), time(0.0) {
-      this->cap = (video != "") ? cv::VideoCapture(video) : cv::VideoCapture(0);
+   AppRenderer(const SPtr<Camera>& cam, const SystemAlgorithms& methods, const vector<PreMarker>& setup,
+               const vector<std::pair<string, string> >& objects, const vector<PreMarker>& databases, const std::string& video,
+               bool pipelined, bool async)
+   : id(0), frame(), cap(), cam(cam), frames(pipelined ? POOL_SIZE_PIPELINE : POOL_SIZE), markers(),
+     run(false), pause(false), count(0), time(0.0), startup(cv::getTickCount()), tracked(false),
+     pipelined(pipelined), captured(QUEUE_SIZE), processed(QUEUE_SIZE), ended(false), grabbed(0), analyzed(0),
+     samples(0), capturedDepth(0), processedDepth(0), captures(0) {
+      this->tracker = new avr::HybridTracker(methods);
+      this->tracker->SetAsync(async);
+      const HybridTracker* preparer = this->tracker.Get();
+
+      // the tasks only receive plain values, the SPtr's reference counter is not thread safe
+      vector<std::future<MarkerFeatures> > prepared;
+      std::map<string, std::future<SPtr<Model> > > loading;
+      std::future<bool> opened;
+      {
+         ThreadPool pool;
+         opened = pool.Submit([this, video]() { return (video != "") ? this->cap.open(video) : this->cap.open(0); });
+
+         for(const auto& it : setup) {
+            string path = it.path;
+            prepared.push_back(pool.Submit([preparer, path]() { return preparer->Prepare(path); }));
+         }
+         for(const auto& it : objects) {
+            string path = it.first, obj = it.second;
+            prepared.push_back(pool.Submit([preparer, path]() { return preparer->Prepare(path); }));
+            if(loading.count(obj) == 0) {
+               loading[obj] = pool.Submit([obj]() {
+                  SPtr<Model> model = FactoryModel::OBJ(obj);
+                  if(model == nullptr)
+                     AVR_FMT_ERROR(Cod::Undefined, "It did not load the model %s", obj.c_str());
+                  model->ComputeFacetNormals();
+                  model->ComputeVertexNormals();
+                  return model;
+               });
+            }
+         }
+      } // waits all tasks
+
+      if(!opened.get())
+         AVR_ERROR(Cod::Undefined, "It did not open the video capture");
       this->frame = cv::Mat(cap.get(CV_CAP_PROP_FRAME_HEIGHT), cap.get(CV_CAP_PROP_FRAME_WIDTH), CV_8UC3);
 
-      this->tracker = new avr::HybridTracker(methods);
+      std::map<string, SPtr<Model> > models;
+      for(auto& it : loading)
+         models[it.first] = it.second.get();
+
+      // the registry changes the tracker, so it is serial in the given order
+      this->markers.reserve(setup.size() + objects.size());
+      for(size_t i = 0; i < setup.size(); i++)
+         this->markers.push_back(this->tracker->Registry(prepared[i].get(), setup[i].model));
+      for(size_t i = 0; i < objects.size(); i++)
+         this->markers.push_back(this->tracker->Registry(prepared[setup.size() + i].get(), models[objects[i].second]));
 
-      this->markers.reserve(setup.size());
-      for(auto it : setup) {
-         Marker marker = this->tracker->Registry(it);
-         this->markers.push_back(marker);
+      for(auto it : databases) {
+         vector<Marker> stored = this->tracker->Registry(MarkerFile::Open(it.path), it.model);
+         this->markers.insert(this->markers.end(), stored.begin(), stored.end());
       }
    }
 
+   ~AppRenderer() {
+      this->run = false;
+      this->Join();
+   }
+
    void Initialize();
    void Render() const;
    void Update();
@@ -40,7 +102,40 @@ public:
 
    void SetID(size_t id) { this->id = id; };
 
+   //! starts the capture and vision threads of the pipelined mode
+   void Launch();
+   //! waits the capture and vision threads, run must be false
+   void Join() const;
+
 private:
+   // result of the vision stage for a marker
+   struct MarkerPose {
+      size_t index;        // position in markers
+      bool lost;
+      bool located;        // the corners and the pose are valid
+      TMatx pose;
+      Coords2D corners;
+      Coords2D points;     // matched or tracked scene points
+   };
+
+   // a frame with its vision results, it is passed from the vision stage to the render stage
+   struct Record {
+      Frame scene;
+      vector<MarkerPose> poses;
+   };
+
+   // pipeline stages
+   bool Capture(Frame& scene) const;
+   void Process(Record& record) const;
+   void Draw(Record& record) const;
+
+   void CaptureLoop();
+   void VisionLoop();
+   // stops the pipeline with the exception of a capture or vision thread
+   void Fail(std::exception_ptr error);
+   // joins the threads and reports the failure on the render thread
+   void Report() const;
+
    void ProjectFrame(const GLvoid* image, GLsizei width, GLsizei height) const;
 
    enum MODE { LOST, TRACKING };
@@ -50,9 +145,14 @@ private:
       std::stringstream stream;
       stream.precision(5);
       stream << (mode == LOST ? "LOST " : "TRACKING ") << fps << "fps";
+      if(this->pipelined)
+         stream << " [queues " << this->captured.Size() << "/" << this->processed.Size() << "]";
       return stream.str();
    }
 
+   // the pool holds the frames in the tracker's history, in both queues and in each stage
+   enum { QUEUE_SIZE = 4, POOL_SIZE = 8, POOL_SIZE_PIPELINE = 16 };
+
 private:
    // TODO: Arrumar essa zona!!
    size_t id;
@@ -61,6 +161,7 @@ private:
 
    mutable SPtr<Camera> cam;
    mutable SPtr<HybridTracker> tracker;
+   mutable FramePool frames;
 
    mutable vector<Marker> markers;
 
@@ -69,13 +170,41 @@ private:
    mutable std::atomic<int>     count;
    mutable std::atomic<double>  time;
 
+   int64 startup;             // tick count when the application was built
+   mutable bool tracked;      // some marker was already tracked
+
+   // pipelined mode: capture -> vision -> render
+   bool pipelined;
+   mutable Record current;             // record on screen
+   mutable RingQueue<Frame>  captured;
+   mutable RingQueue<Record> processed;
+   mutable std::thread captureThread;
+   mutable std::thread visionThread;
+   mutable std::mutex failureLock;
+   mutable std::exception_ptr failure; // first exception thrown by a capture or vision thread
+   std::atomic<bool> ended;            // the capture has no more frames
+   std::atomic<int>  grabbed;          // frames captured
+   std::atomic<int>  analyzed;         // frames processed by the vision
+   mutable size_t samples, capturedDepth, processedDepth;   // queue depths summed on each rendered frame
+   mutable size_t captures;            // number of the next captured frame
+
    GLuint texture;
 
    friend class Application;
 };
 
-Application::Application(const Builder& builder) : id(0), app(nullptr) {
-   this->app = new AppRenderer(builder.cam, *builder.methods, builder.markers, builder.path);
+Application::Application(const Builder& builder) : id(0), app(nullptr), tracePath(builder.tracePath), started(false) {
+   double traceSeconds = builder.traceSeconds;
+   if(this->tracePath.empty() && std::getenv("AVR_TRACE") != nullptr) {
+      this->tracePath = std::getenv("AVR_TRACE");
+      if(std::getenv("AVR_TRACE_SECONDS") != nullptr)
+         traceSeconds = std::atof(std::getenv("AVR_TRACE_SECONDS"));
+   }
+   if(!this->tracePath.empty())
+      Tracer::Instance().Enable(traceSeconds);
+
+   this->app = new AppRenderer(builder.cam, *builder.methods, builder.markers, builder.objects, builder.databases, builder.path,
+                               builder.pipelined, builder.async);
 
    SPtr<Window> win = WindowManager::Create(GLUT::Window::Builder(builder.label));
    win->SetSize(this->app->frame.size());
@@ -85,22 +214,43 @@ Application::Application(const Builder& builder) : id(0), app(nullptr) {
 }
 
 Application::~Application() {
-   if(this->app->run) {
+   // after a stage failure run is already false, but the stats, the trace and the window are still pending
+   if(this->started) {
       this->Stop();
    }
 }
 
 void Application::Start() {
+   this->started = true;
    this->app->run = true;
    this->app->time = (double) cv::getTickCount();
+   Tracer::Instance().SetThreadName("render");
+   if(this->app->pipelined)
+      this->app->Launch();
    GLUT::EnterMainLoop();
 }
 
 void Application::Stop() {
+   this->started = false;
    this->app->run = false;
+   this->app->Join();
    WindowManager::Destroy(this->id);
    this->app->time = (double)(cv::getTickCount() - this->app->time) / cv::getTickFrequency();
    cout << (double(this->app->count)/this->app->time) << " fps\n";
+   if(this->app->pipelined) {
+      double samples = std::max<size_t>(this->app->samples, 1);
+      cout << "capture " << (double(this->app->grabbed)/this->app->time) << " fps, "
+           << "vision " << (double(this->app->analyzed)/this->app->time) << " fps, "
+           << "mean queue depths " << (this->app->capturedDepth/samples) << " / " << (this->app->processedDepth/samples) << "\n";
+   }
+   for(const auto& probe : this->Stats()) {
+      cout << probe.name << ": " << probe.count << " times, mean " << probe.mean << " ms, p50 " << probe.p50
+           << " ms, p99 " << probe.p99 << " ms, max " << probe.max << " ms";
+      if(probe.counter > 0) cout << ", counter " << probe.counter;
+      cout << "\n";
+   }
+   if(!this->tracePath.empty() && this->WriteTrace(this->tracePath))
+      cout << "Trace written to " << this->tracePath << "\n";
    //GLUT::LeaveMainLoop();
 }
 
@@ -117,6 +267,14 @@ void Application::AddListener(const SPtr<EventListener>& ltn) {
    win->AddListener(ltn);
 }
 
+std::vector<ProbeStats> Application::Stats() const {
+   return Profiler::Instance().Collect();
+}
+
+bool Application::WriteTrace(const std::string& path) const {
+   return Tracer::Instance().Write(path);
+}
+
 cv::Mat Application::Screenshot() {
    char outname[64];
    time_t rawtime = std::time(nullptr);
@@ -139,92 +297,269 @@ cv::Mat Application::Screenshot() {
 
 //! Main Loop
 void Application::AppRenderer::Render() const {
+   // a stage thread failed, the pipeline was stopped
+   if(this->pipelined && !this->run) {
+      this->Report();
+      return;
+   }
    // render if I can
    if(this->run && !this->pause) {
-      Frame scene;
-      this->cap >> scene.image;
-      if(scene.image.empty()) return;
-      this->frame = scene.image;
+      AVR_PROFILE_SCOPE("app.render");
+      if(this->pipelined) {
+         // nothing new, the last frame stays on screen
+         if(!this->processed.Pop(this->current)) return;
+         this->samples++;
+         this->capturedDepth += this->captured.Size();
+         this->processedDepth += this->processed.Size();
+      } else {
+         if(!this->Capture(this->current.scene)) return;
+         this->Process(this->current);
+      }
 
       this->count++;
+      this->Draw(this->current);
+   }
+}
 
-      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+bool Application::AppRenderer::Capture(Frame& scene) const {
+   AVR_PROFILE_SCOPE("app.capture");
+   // the frame's buffers are recycled, the capture writes in place after the first frames
+   Frame& next = this->frames.Acquire();
+   next.number = this->captures++;
+   Tracer::SetFrame(next.number);
+   AVR_TRACE_SCOPE("capture");
+   this->cap >> next.image;
+   if(next.image.empty()) return false;
+   scene = next;
+   return true;
+}
 
-      glDepthFunc(GL_LEQUAL);
-      glEnable(GL_DEPTH_TEST);
+void Application::AppRenderer::Process(Record& record) const {
+   AVR_PROFILE_SCOPE("app.process");
+   Frame& scene = record.scene;
+   record.poses.resize(this->markers.size());
+   Tracer::SetFrame(scene.number);
+
+   // computer visio process //
+   this->tracker->Update(scene);
+   this->tracker->FindAll(this->markers, scene);
+   for(size_t i = 0; i < this->markers.size(); i++) {
+      Marker& marker = this->markers[i];
+      MarkerPose& out = record.poses[i];
+      const Matches& result = marker.GetMatches();
+      AVR_TRACE_MARKER(marker.GetID());
+
+      if(result.size() > 20)
+         marker.SetLost(false);
+      else marker.SetLost(true);
+
+      out.index = i;
+      out.lost = marker.Lost();
+      out.located = false;
+      out.points.assign(result.scenePts().begin(), result.scenePts().end());
+      out.corners.clear();
+
+      if(result.size() >= 4) {
+         const Coords2D& markerCorners = marker.GetWorld();
+
+         Mat homography;
+         vector<uchar> inliers;
+         {
+            AVR_TRACE_SCOPE("findHomography");
+            homography = cv::findHomography(result.targetPts(), result.scenePts(), cv::RANSAC, 4, inliers);
+         }
+         if(homography.empty()) continue;
+         cv::perspectiveTransform(markerCorners, out.corners, homography);
+
+         // the pose comes from the homography, then it is refined on the RANSAC inliers
+         Point2f center(marker.GetSize().width/2.0, marker.GetSize().height/2.0);
+         PlanarPose planar = this->cam->PoseFromHomography(cv::Matx33d(homography), center, markerCorners);
+         // the motion of a tracked marker solves the ambiguity of the planar pose
+         const MotionModel& motion = marker.GetTrack().motion;
+         const TMatx& initial = motion.Posed() ? planar.Closest(motion.PredictPose()) : planar.poses[0];
+         if(!marker.Lost()) marker.SetHomography(cv::Matx33d(homography));
+
+         Coords3D world;
+         Coords2D location;
+         for(size_t k = 0; k < inliers.size(); k++) {
+            if(!inliers[k]) continue;
+            const Point2f& target = result.targetPts(k);
+            world.push_back(Point3f(target.x - center.x, target.y - center.y, 0.0f));
+            location.push_back(result.scenePts(k));
+         }
 
-      TMatx proj = this->cam->Projection(0.01, 1000.0);
-      glMatrixMode(GL_PROJECTION);
-      glLoadMatrixd(proj.T().Get().val);
+         // a homography that no rigid pose explains is a poor start, the PnP starts from the predicted pose instead
+         if(motion.Posed() && planar.errors[0] > PLANAR_MAX_ERROR && world.size() >= 4)
+            out.pose = this->cam->Pose(world, location, motion.PredictPose());
+         else
+            out.pose = this->cam->Refine(initial, world, location);
+         out.located = true;
+         marker.SetPose(out.pose);
+      }
+   }
+   // computer visio process end //
+}
 
-      // computer visio process //
-      this->tracker->Update(scene);
-      for(auto& marker : this->markers) {
-         Matches result = this->tracker->Find(marker, scene);
+void Application::AppRenderer::Draw(Record& record) const {
+   Frame& scene = record.scene;
+   Tracer::SetFrame(scene.number);
 
-         if(marker.Lost())
-            WindowManager::Get(this->id)->SetLabel(GetLabel(LOST));
-         else
-            WindowManager::Get(this->id)->SetLabel(GetLabel(TRACKING));
+   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-         if(result.size() > 20)
-            marker.SetLost(false);
-         else marker.SetLost(true);
+   glDepthFunc(GL_LEQUAL);
+   glEnable(GL_DEPTH_TEST);
 
-         if(result.size() >= 4) {
-            Coords2D sceneCorners;
-            const Coords2D& markerCorners = marker.GetWorld();
+   TMatx proj = this->cam->Projection(0.01, 1000.0);
 
-            Mat homography = cv::findHomography(result.targetPts(), result.scenePts(), cv::RANSAC, 4);
-            cv::perspectiveTransform(markerCorners, sceneCorners, homography);
+   bool anyTracked = false;
+   for(const auto& it : record.poses) {
+      anyTracked = anyTracked || !it.lost;
 
-            Coords3D world = Coords3D(4);
-            Point3f center(marker.GetSize().width/2.0, marker.GetSize().height/2.0, 0.0f);
-            world[0] = Point3f(-center.x, -center.y, 0.0f);
-            world[3] = Point3f(-center.x, +center.y, 0.0f);
-            world[2] = Point3f(+center.x, +center.y, 0.0f);
-            world[1] = Point3f(+center.x, -center.y, 0.0f);
+      if(it.located) {
+         glMatrixMode(GL_PROJECTION);
+         glLoadMatrixd(proj.T().Get().val);
 
-            TMatx pose = this->cam->Pose(world, sceneCorners, marker.Lost());
-            glMatrixMode(GL_MODELVIEW);
-            glLoadMatrixd(pose.T().Get().val);
+         glMatrixMode(GL_MODELVIEW);
+         glLoadMatrixd(it.pose.T().Get().val);
 
-            TMatx ipose = pose.Inv();
-            float position[] = { float(ipose(0, 3)), float(ipose(1, 3)), float(ipose(2, 3)), 1.0 };
-            glLightfv(GL_LIGHT0, GL_POSITION, position);
+         TMatx ipose = it.pose.Inv();
+         float position[] = { float(ipose(0, 3)), float(ipose(1, 3)), float(ipose(2, 3)), 1.0 };
+         glLightfv(GL_LIGHT0, GL_POSITION, position);
 
-            glEnable(GL_LIGHTING);
-            glEnable(GL_CULL_FACE);
-               SPtr<Model> model = marker.GetModel();
+         glEnable(GL_LIGHTING);
+         glEnable(GL_CULL_FACE);
+            // the markers of a database may be registered without a model, only their corners are drawn
+            SPtr<Model> model = this->markers[it.index].GetModel();
+            if(model != nullptr) {
                Size3D dims = model->GetDims();
+               float scale = this->markers[it.index].GetModelScale();
 
-               glTranslatef(0.0f, 0.0f, -dims.height / 2);
+               glTranslatef(0.0f, 0.0f, -scale * dims.height / 2);
                glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);
+               glScalef(scale, scale, scale);
+
+               AVR_TRACE_MARKER(this->markers[it.index].GetID());
+               AVR_TRACE_SCOPE("Model::Draw");
                model->Draw();
-            glDisable(GL_LIGHTING);
-            glDisable(GL_CULL_FACE);
-
-            if(!sceneCorners.empty()) {
-               cv::line(scene.image, sceneCorners[0], sceneCorners[1], cv::Scalar(0, 255, 0), 4);
-               cv::line(scene.image, sceneCorners[1], sceneCorners[2], cv::Scalar(0, 255, 0), 4);
-               cv::line(scene.image, sceneCorners[2], sceneCorners[3], cv::Scalar(0, 255, 0), 4);
-               cv::line(scene.image, sceneCorners[3], sceneCorners[0], cv::Scalar(0, 255, 0), 4);
             }
+         glDisable(GL_LIGHTING);
+         glDisable(GL_CULL_FACE);
+
+         if(!it.corners.empty()) {
+            cv::line(scene.image, it.corners[0], it.corners[1], cv::Scalar(0, 255, 0), 4);
+            cv::line(scene.image, it.corners[1], it.corners[2], cv::Scalar(0, 255, 0), 4);
+            cv::line(scene.image, it.corners[2], it.corners[3], cv::Scalar(0, 255, 0), 4);
+            cv::line(scene.image, it.corners[3], it.corners[0], cv::Scalar(0, 255, 0), 4);
          }
+      }
 
-         for(auto p : result.scenePts()) {
-            cv::circle(scene.image, p, 3, cv::Scalar(0, 255, 0), 1);
+      for(auto p : it.points) {
+         cv::circle(scene.image, p, 3, cv::Scalar(0, 255, 0), 1);
+      }
+   }
+
+   WindowManager::Get(this->id)->SetLabel(GetLabel(anyTracked ? TRACKING : LOST));
+   if(!this->tracked && anyTracked) {
+      this->tracked = true;
+      double elapsed = (cv::getTickCount() - this->startup) / cv::getTickFrequency();
+      cout << "time to first tracked frame: " << elapsed * 1000.0 << " ms\n";
+   }
+
+   ProjectFrame(scene.image.ptr<GLubyte>(0), (GLsizei) scene.image.cols, (GLsizei) scene.image.rows);
+
+   glDisable(GL_DEPTH_TEST);
+   glutSwapBuffers ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------*\
+*                                                                  Pipeline                                                                   *
+\*-------------------------------------------------------------------------------------------------------------------------------------------*/
+
+namespace {
+
+// waits a little for a stage that is ahead of the next one (or behind the previous one)
+inline void backoff() {
+   std::this_thread::sleep_for(std::chrono::microseconds(500));
+}
+
+} // namespace
+
+void Application::AppRenderer::Launch() {
+   this->ended = false;
+   this->captureThread = std::thread(&AppRenderer::CaptureLoop, this);
+   this->visionThread = std::thread(&AppRenderer::VisionLoop, this);
+}
+
+void Application::AppRenderer::Join() const {
+   if(this->captureThread.joinable()) this->captureThread.join();
+   if(this->visionThread.joinable()) this->visionThread.join();
+}
+
+void Application::AppRenderer::CaptureLoop() {
+   Tracer::Instance().SetThreadName("capture");
+   Frame scene;
+   try {
+      while(this->run) {
+         if(this->pause) { backoff(); continue; }
+         if(!this->Capture(scene)) break;
+         this->grabbed++;
+
+         // a video file must not skip frames, so it waits for the vision stage
+         while(this->run && !this->captured.Push(scene))
+            backoff();
+      }
+   } catch(...) {
+      this->Fail(std::current_exception());
+   }
+   this->ended = true;
+}
+
+void Application::AppRenderer::VisionLoop() {
+   Tracer::Instance().SetThreadName("vision");
+   Record record;
+   try {
+      while(this->run) {
+         if(!this->captured.Pop(record.scene)) {
+            if(this->ended && this->captured.Size() == 0) break;
+            backoff(); continue;
          }
+         this->Process(record);
+         this->analyzed++;
 
-         Mat flipped;
-         cv::flip(scene.image, flipped, 0);
-         ProjectFrame(flipped.ptr<GLubyte>(0), (GLsizei) flipped.cols, (GLsizei) flipped.rows);
+         while(this->run && !this->processed.Push(record))
+            backoff();
       }
-      // computer visio process end //
+   } catch(...) {
+      this->Fail(std::current_exception());
+   }
+}
 
-      glDisable(GL_DEPTH_TEST);
-      glutSwapBuffers ();
+void Application::AppRenderer::Fail(std::exception_ptr error) {
+   {
+      std::lock_guard<std::mutex> lock(this->failureLock);
+      if(!this->failure) this->failure = error;
    }
+   // the other stage leaves its loop too
+   this->run = false;
+}
+
+void Application::AppRenderer::Report() const {
+   std::exception_ptr error;
+   {
+      std::lock_guard<std::mutex> lock(this->failureLock);
+      std::swap(error, this->failure);
+   }
+   if(!error) return;
+
+   this->Join();
+   try {
+      std::rethrow_exception(error);
+   } catch(const std::exception& e) {
+      cerr << "Pipeline stopped: " << e.what() << "\n";
+   } catch(...) {
+      cerr << "Pipeline stopped: unknown error\n";
+   }
+   GLUT::LeaveMainLoop();
 }
 
 void Application::AppRenderer::Update() {
@@ -248,11 +583,19 @@ void Application::AppRenderer::Initialize() {
    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, this->frame.cols, this->frame.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, this->frame.ptr<GLubyte>(0));
    glDisable(GL_TEXTURE_2D);
 
+   // the models are loaded on build, but their display lists need the GL context, each shared model is compiled once
+   std::set<const Model*> compiled;
+   for(auto& marker : this->markers) {
+      SPtr<Model> model = marker.GetModel();
+      if(model != nullptr && compiled.insert(&(*model)).second) model->Compile();
+   }
+
    // setup light and material
 	glEnable(GL_COLOR_MATERIAL);  // Utiliza cor do objeto como material
 	glColorMaterial(GL_FRONT_AND_BACK, GL_DIFFUSE);
 
 	glEnable(GL_LIGHT0);
+   glEnable(GL_NORMALIZE);   // the models are scaled by the modelview matrix
    glLightf(GL_LIGHT0, GL_LINEAR_ATTENUATION,0.0f);
    glLightf(GL_LIGHT0, GL_QUADRATIC_ATTENUATION, 0.0f);
    glLightf(GL_LIGHT0, GL_CONSTANT_ATTENUATION , 1.0f);
@@ -272,20 +615,24 @@ void Application::AppRenderer::ProjectFrame(const GLvoid* image, GLsizei width,
 
    glEnable(GL_TEXTURE_2D);
    glBindTexture(GL_TEXTURE_2D, this->texture);
-   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, image);
+   {
+      AVR_TRACE_SCOPE("texture upload");
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, image);
+   }
 
+   // the image's first row is its top, so the texture is flipped by its coordinates instead of flipping the image
    glColor3d(1.0, 1.0, 1.0);
    glBegin(GL_QUADS);
-      glTexCoord2i(0, 0);
+      glTexCoord2i(0, 1);
       glVertex3i(0, 0, -1);
 
-      glTexCoord2i(0, 1);
+      glTexCoord2i(0, 0);
       glVertex3i(0, height, -1);
 
-      glTexCoord2i(1, 1);
+      glTexCoord2i(1, 0);
       glVertex3i(width, height, -1);
 
-      glTexCoord2i(1, 0);
+      glTexCoord2i(1, 1);
       glVertex3i(width, 0, -1);
    glEnd();
 
@@ -5,6 +5,21 @@
 
 namespace avr {
 
+//! Mean error in pixels of the best PlanarPose above which a rigid pose does not explain the homography
+const double PLANAR_MAX_ERROR = 4.0;
+
+/**
+ * @struct PlanarPose Camera.hpp <avr/camera/Camera.hpp>
+ * @brief The two poses of a plane that explain a homography, they are ambiguous when the plane is small or far
+ */
+struct PlanarPose {
+   TMatx  poses[2];     // the best solution first
+   double errors[2];    // mean reprojection error in pixels, the ranking criterion
+
+   //! @return The solution closer to the predicted pose if both explain the points, otherwise the best one
+   const TMatx& Closest(const TMatx& predicted) const;
+};
+
 class Camera {
 public:
    //! @param filename Path to camera calibration file
@@ -16,12 +31,32 @@ public:
              const std::vector<Point2f>& location,
              bool lost = true) const;
 
+   //! @return The camera's pose matrix, refined from a guess (e.g. the predicted pose of a tracked marker)
+   TMatx Pose(const std::vector<Point3f>& world,
+             const std::vector<Point2f>& location,
+             const TMatx& guess) const;
+
    //! @return The camera's pose matrix
    //! @note param world is a 3D world coordinates with z = 0
    TMatx Pose(const std::vector<Point2f>& world,
              const std::vector<Point2f>& location,
              bool lost = true) const;
 
+   /**
+    * Closed-form pose of a plane from its homography (IPPE), without any PnP iteration
+    * @param homography Maps the plane points (x, y) to pixels, e.g. the RANSAC homography of the matches
+    * @param center The plane point placed at the world origin, world = (x - center.x, y - center.y, 0) as in Pose
+    * @param points Plane points used to find the translation and to rank the solutions, at least 2 (e.g. the corners)
+    * @note The lens distortion is ignored, Refine accounts for it
+    */
+   PlanarPose PoseFromHomography(const Matx33d& homography, const Point2f& center, const std::vector<Point2f>& points) const;
+
+   //! @return The pose refined by Gauss-Newton steps on the reprojection error of the given points
+   TMatx Refine(const TMatx& pose,
+               const std::vector<Point3f>& world,
+               const std::vector<Point2f>& location,
+               int iterations = 3) const;
+
    //! @return The camera's projection matrix
    TMatx Projection(float near, float far) const;
 
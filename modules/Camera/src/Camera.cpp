@@ -2,15 +2,55 @@
 #include <opencv2/calib3d/calib3d.hpp>
 
 #include <avr/camera/Camera.hpp>
+#include <avr/core/Profiler.hpp>
+#include <avr/core/Trace.hpp>
 
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 using namespace avr;
 
 const unsigned IT_MAX = 72;
 
+namespace {
+
+//! Rotation that takes the optical axis (0, 0, 1) to the direction of (p, q, 1)
+cv::Matx33d AxisRotation(double p, double q) {
+   double t = std::sqrt(p*p + q*q);
+   if(t < 1e-12) return cv::Matx33d::eye();
+
+   double s = std::sqrt(p*p + q*q + 1.0);
+   double cosT = 1.0 / s, sinT = t / s;
+   double kx = -q / t, ky = p / t;
+   cv::Matx33d k(0.0, 0.0, ky,
+                 0.0, 0.0, -kx,
+                 -ky, kx, 0.0);
+   return cv::Matx33d::eye() + sinT * k + (1.0 - cosT) * (k * k);
+}
+
+//! Least squares translation of a plane rotation, given the plane points and their normalized image points
+cv::Vec3d PlaneTranslation(const cv::Matx33d& R, const std::vector<cv::Point2d>& plane, const std::vector<cv::Point2d>& image) {
+   cv::Matx33d AtA = cv::Matx33d::zeros();
+   cv::Vec3d   Atb(0.0, 0.0, 0.0);
+   for(size_t i = 0; i < plane.size(); i++) {
+      double x = plane[i].x, y = plane[i].y;
+      double u = image[i].x, v = image[i].y;
+      double r1 = R(0, 0)*x + R(0, 1)*y, r2 = R(1, 0)*x + R(1, 1)*y, r3 = R(2, 0)*x + R(2, 1)*y;
+      // [1 0 -u; 0 1 -v] t = [u r3 - r1; v r3 - r2]
+      double bu = u*r3 - r1, bv = v*r3 - r2;
+      AtA(0, 0) += 1.0;    AtA(0, 2) += -u;
+      AtA(1, 1) += 1.0;    AtA(1, 2) += -v;
+      AtA(2, 0) += -u;     AtA(2, 1) += -v;     AtA(2, 2) += u*u + v*v;
+      Atb[0] += bu;        Atb[1] += bv;        Atb[2] += -u*bu - v*bv;
+   }
+   return AtA.solve(Atb, cv::DECOMP_CHOLESKY);
+}
+
+} // namespace
+
 Camera::Camera(const std::string& filename) : intrinsecs(), resolution(Size2f(0.0, 0.0)) {
    cv::FileStorage reader(filename, cv::FileStorage::READ);
    cv::Mat cameraMatrix, distCoeffs;
@@ -25,7 +65,8 @@ Camera::Camera(const std::string& filename) : intrinsecs(), resolution(Size2f(0.
 }
 
 TMatx Camera::Pose(const std::vector<Point3f>& world, const std::vector<Point2f>& location, bool lost) const {
-   static bool first = true;
+   AVR_PROFILE_SCOPE("camera.pose");
+   AVR_TRACE_SCOPE("Camera::Pose");
 
    AVR_ASSERT(world.size() == location.size());
 
@@ -33,8 +74,7 @@ TMatx Camera::Pose(const std::vector<Point3f>& world, const std::vector<Point2f>
    cv::Vec3d   translat;
 
    if(lost){
-      cv::solvePnPRansac(world, location, this->intrinsecs, this->distortion, rotVec, translat, !first, IT_MAX, 8.0, 4, cv::noArray(), CV_EPNP);
-      first = false;
+      cv::solvePnPRansac(world, location, this->intrinsecs, this->distortion, rotVec, translat, false, IT_MAX, 8.0, 4, cv::noArray(), CV_EPNP);
    } else { // tracking
       cv::solvePnP(world, location, this->intrinsecs, this->distortion, rotVec, translat, false, CV_ITERATIVE);
    }
@@ -44,11 +84,158 @@ TMatx Camera::Pose(const std::vector<Point3f>& world, const std::vector<Point2f>
    return TMatx(rotation, translat);
 }
 
+TMatx Camera::Pose(const std::vector<Point3f>& world, const std::vector<Point2f>& location, const TMatx& guess) const {
+   AVR_PROFILE_SCOPE("camera.pose");
+   AVR_TRACE_SCOPE("Camera::Pose");
+
+   AVR_ASSERT(world.size() == location.size());
+
+   cv::Matx33d rotation(guess(0, 0), guess(0, 1), guess(0, 2),
+                        guess(1, 0), guess(1, 1), guess(1, 2),
+                        guess(2, 0), guess(2, 1), guess(2, 2));
+   cv::Vec3d   rotVec;
+   cv::Vec3d   translat(guess(0, 3), guess(1, 3), guess(2, 3));
+   cv::Rodrigues(rotation, rotVec);
+
+   cv::solvePnP(world, location, this->intrinsecs, this->distortion, rotVec, translat, true, CV_ITERATIVE);
+
+   cv::Rodrigues(rotVec, rotation);
+   return TMatx(rotation, translat);
+}
+
 TMatx Camera::Pose(const std::vector<Point2f>& world, const std::vector<Point2f>& location, bool lost) const {
    std::vector<Point3f> _world(world.begin(), world.end());
    return this->Pose(_world, location, lost);
 }
 
+const TMatx& PlanarPose::Closest(const TMatx& predicted) const {
+   // the second solution is kept only if it explains the points about as well as the first one
+   if(this->errors[1] > 2.0 * this->errors[0] + 1.0) return this->poses[0];
+
+   double trace[2] = { 0.0, 0.0 };
+   for(int k = 0; k < 2; k++)
+      for(int i = 0; i < 3; i++)
+         for(int j = 0; j < 3; j++)
+            trace[k] += this->poses[k](j, i) * predicted(j, i);   // trace(R^T R_predicted), larger is closer
+   return (trace[1] > trace[0]) ? this->poses[1] : this->poses[0];
+}
+
+PlanarPose Camera::PoseFromHomography(const Matx33d& homography, const Point2f& center, const std::vector<Point2f>& points) const {
+   AVR_PROFILE_SCOPE("camera.planar");
+   AVR_TRACE_SCOPE("Camera::PoseFromHomography");
+
+   AVR_ASSERT(points.size() >= 2);
+
+   // homography from the centered plane to the normalized image
+   cv::Matx33d K(this->intrinsecs(0, 0), this->intrinsecs(0, 1), this->intrinsecs(0, 2),
+                 this->intrinsecs(1, 0), this->intrinsecs(1, 1), this->intrinsecs(1, 2),
+                 this->intrinsecs(2, 0), this->intrinsecs(2, 1), this->intrinsecs(2, 2));
+   cv::Matx33d shift(1.0, 0.0, center.x,
+                     0.0, 1.0, center.y,
+                     0.0, 0.0, 1.0);
+   cv::Matx33d H = K.inv() * homography * shift;
+   H *= 1.0 / H(2, 2);
+
+   // jacobian of the homography at the plane origin, which is seen in the direction (p, q, 1)
+   const double p = H(0, 2), q = H(1, 2);
+   cv::Matx22d J(H(0, 0) - H(2, 0)*p, H(0, 1) - H(2, 1)*p,
+                 H(1, 0) - H(2, 0)*q, H(1, 1) - H(2, 1)*q);
+
+   cv::Matx33d Rv = AxisRotation(p, q);
+   cv::Matx22d B(Rv(0, 0) - p*Rv(2, 0), Rv(0, 1) - p*Rv(2, 1),
+                 Rv(1, 0) - q*Rv(2, 0), Rv(1, 1) - q*Rv(2, 1));
+   cv::Matx22d A = B.inv() * J;
+
+   // largest singular value of A, the scale of the plane
+   double frob = A(0, 0)*A(0, 0) + A(0, 1)*A(0, 1) + A(1, 0)*A(1, 0) + A(1, 1)*A(1, 1);
+   double det = A(0, 0)*A(1, 1) - A(0, 1)*A(1, 0);
+   double gamma = std::sqrt(0.5 * (frob + std::sqrt(std::max(0.0, frob*frob - 4.0*det*det))));
+   cv::Matx22d R22 = A * (1.0 / gamma);
+
+   double b0 = std::sqrt(std::max(0.0, 1.0 - R22(0, 0)*R22(0, 0) - R22(1, 0)*R22(1, 0)));
+   double b1 = std::sqrt(std::max(0.0, 1.0 - R22(0, 1)*R22(0, 1) - R22(1, 1)*R22(1, 1)));
+   if(-(R22(0, 0)*R22(0, 1) + R22(1, 0)*R22(1, 1)) < 0.0) b1 = -b1;
+
+   // plane points, centered and normalized image
+   std::vector<cv::Point2d> plane(points.size()), image(points.size()), pixels(points.size());
+   for(size_t i = 0; i < points.size(); i++) {
+      plane[i] = cv::Point2d(points[i].x - center.x, points[i].y - center.y);
+      cv::Vec3d n = H * cv::Vec3d(plane[i].x, plane[i].y, 1.0);
+      image[i] = cv::Point2d(n[0] / n[2], n[1] / n[2]);
+      pixels[i] = cv::Point2d(K(0, 0)*image[i].x + K(0, 1)*image[i].y + K(0, 2), K(1, 1)*image[i].y + K(1, 2));
+   }
+
+   PlanarPose out;
+   for(int k = 0; k < 2; k++) {
+      double sign = (k == 0) ? 1.0 : -1.0;
+      cv::Vec3d c1(R22(0, 0), R22(1, 0), sign * b0);
+      cv::Vec3d c2(R22(0, 1), R22(1, 1), sign * b1);
+      cv::Vec3d c3 = c1.cross(c2);
+      cv::Matx33d local(c1[0], c2[0], c3[0],
+                        c1[1], c2[1], c3[1],
+                        c1[2], c2[2], c3[2]);
+      cv::Matx33d R = Rv * local;
+      cv::Vec3d t = PlaneTranslation(R, plane, image);
+
+      double error = 0.0;
+      for(size_t i = 0; i < plane.size(); i++) {
+         cv::Vec3d x = K * (R * cv::Vec3d(plane[i].x, plane[i].y, 0.0) + t);
+         double dx = x[0] / x[2] - pixels[i].x, dy = x[1] / x[2] - pixels[i].y;
+         error += std::sqrt(dx*dx + dy*dy);
+      }
+      out.poses[k] = TMatx(R, t);
+      out.errors[k] = error / plane.size();
+   }
+   if(out.errors[1] < out.errors[0]) {
+      std::swap(out.poses[0], out.poses[1]);
+      std::swap(out.errors[0], out.errors[1]);
+   }
+   return out;
+}
+
+TMatx Camera::Refine(const TMatx& pose, const std::vector<Point3f>& world, const std::vector<Point2f>& location, int iterations) const {
+   AVR_PROFILE_SCOPE("camera.refine");
+   AVR_TRACE_SCOPE("Camera::Refine");
+
+   AVR_ASSERT(world.size() == location.size());
+   if(world.size() < 3) return pose;
+
+   cv::Matx33d rotation(pose(0, 0), pose(0, 1), pose(0, 2),
+                        pose(1, 0), pose(1, 1), pose(1, 2),
+                        pose(2, 0), pose(2, 1), pose(2, 2));
+   cv::Vec3d rotVec, translat(pose(0, 3), pose(1, 3), pose(2, 3));
+   cv::Rodrigues(rotation, rotVec);
+
+   std::vector<Point2f> projected;
+   cv::Mat jacobian;
+   for(int it = 0; it < iterations; it++) {
+      cv::projectPoints(world, rotVec, translat, this->intrinsecs, this->distortion, projected, jacobian);
+
+      // normal equations of the rotation and translation columns of the jacobian
+      cv::Matx66d JtJ = cv::Matx66d::zeros();
+      cv::Vec6d   Jtr(0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+      for(int r = 0; r < jacobian.rows; r++) {
+         const double* J = jacobian.ptr<double>(r);
+         const Point2f& d = location[r / 2] - projected[r / 2];
+         double res = (r % 2 == 0) ? d.x : d.y;
+         for(int i = 0; i < 6; i++) {
+            Jtr[i] += J[i] * res;
+            for(int j = 0; j < 6; j++)
+               JtJ(i, j) += J[i] * J[j];
+         }
+      }
+      cv::Vec6d step;
+      if(!cv::solve(JtJ, Jtr, step, cv::DECOMP_CHOLESKY)) break;
+
+      rotVec += cv::Vec3d(step[0], step[1], step[2]);
+      translat += cv::Vec3d(step[3], step[4], step[5]);
+      if(cv::norm(step) < 1e-8) break;
+   }
+
+   cv::Rodrigues(rotVec, rotation);
+   return TMatx(rotation, translat);
+}
+
 TMatx Camera::Projection(float near, float far) const {
    const float& width = resolution.width;
    const float& height = resolution.height;
@@ -0,0 +1,148 @@
+#ifndef AVR_PROFILER_HPP
+#define AVR_PROFILER_HPP
+
+#ifdef __cplusplus
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <avr/core/RingQueue.hpp>
+
+/** @def AVR_PROFILE_SCOPE macro function: it times the enclosing scope under the given probe name
+ *  Usage: AVR_PROFILE_SCOPE("module.stage");
+ *
+ *  @def AVR_PROFILE_COUNT macro function: it adds a value to the monotonic counter of the given probe name
+ *  Usage: AVR_PROFILE_COUNT("module.event", 1);
+ *
+ *  Both compile to nothing unless AVR_PROFILE is defined, a module instrumented with them must be built with the flag
+ *  to record anything. The probe name must be a string literal, its ID is registered once per call site.
+ */
+#ifdef AVR_PROFILE
+    #define AVR_PROFILE_CAT_(a, b) a##b
+    #define AVR_PROFILE_CAT(a, b) AVR_PROFILE_CAT_(a, b)
+    #define AVR_PROFILE_SCOPE( name ) \
+        static const size_t AVR_PROFILE_CAT(avr_probe_, __LINE__) = avr::Profiler::Instance().Register(name); \
+        avr::ScopedTimer AVR_PROFILE_CAT(avr_timer_, __LINE__)(AVR_PROFILE_CAT(avr_probe_, __LINE__))
+    #define AVR_PROFILE_COUNT( name, value ) do { \
+        static const size_t avr_probe = avr::Profiler::Instance().Register(name); \
+        avr::Profiler::Instance().Count(avr_probe, value); \
+    } while(false)
+#else
+    #define AVR_PROFILE_SCOPE( name ) ((void) 0)
+    #define AVR_PROFILE_COUNT( name, value ) ((void) 0)
+#endif // AVR_PROFILE
+
+namespace avr {
+
+/**
+ * @class Histogram Profiler.hpp <avr/core/Profiler.hpp>
+ * @brief Fixed-bucket latency histogram, the bucket i holds the durations in [2^i, 2^(i+1)) microseconds
+ */
+class Histogram {
+public:
+   enum { BUCKETS = 24 };
+
+   Histogram() { this->Clear(); }
+
+   void Add(int64_t nanoseconds);
+   void Clear();
+
+   //! @return The upper bound of the bucket of the p-th percentile in milliseconds, p in [0, 100]
+   double Percentile(double p) const;
+
+   uint64_t count;
+   int64_t  total;     // nanoseconds
+   int64_t  min, max;  // nanoseconds
+   uint64_t buckets[BUCKETS];
+};
+
+//! Statistics of a probe at the collection moment, the times are in milliseconds
+struct ProbeStats {
+   std::string name;
+   uint64_t    count;      // number of timed scopes
+   uint64_t    counter;    // sum of the counted values
+   double      total, mean, min, max;
+   double      p50, p95, p99;
+};
+
+/**
+ * @class Profiler Profiler.hpp <avr/core/Profiler.hpp>
+ * @brief Low-overhead collector of scoped timings and counters of the whole process
+ *
+ * Each thread writes its timings into its own lock-free ring, so the hot paths never lock nor allocate after the first
+ * sample. Collect drains the rings into the histograms, the samples of a full ring are dropped and counted.
+ * Usually it is used only through the AVR_PROFILE_SCOPE and AVR_PROFILE_COUNT macros.
+ */
+class Profiler {
+public:
+   enum { MAX_PROBES = 128, RING_SIZE = 4096 };
+
+   static Profiler& Instance();
+
+   //! @return The ID of the probe name, the same name always gives the same ID
+   size_t Register(const std::string& name);
+   //! Records a timing of the calling thread
+   void Record(size_t probe, int64_t nanoseconds);
+   //! Adds a value to the counter of the probe
+   void Count(size_t probe, int64_t value) { this->counters[probe].fetch_add(value, std::memory_order_relaxed); }
+
+   //! Drains the rings of all threads @return The statistics of every probe recorded so far
+   std::vector<ProbeStats> Collect();
+   //! Clears the histograms and counters
+   void Reset();
+
+   //! @return The number of samples dropped because a ring was full
+   uint64_t Dropped() const { return this->dropped.load(); }
+
+private:
+   struct Sample {
+      uint32_t probe;
+      int64_t  nanoseconds;
+   };
+   typedef RingQueue<Sample> Ring;
+
+   Profiler();
+   Profiler(const Profiler&);
+   Profiler& operator = (const Profiler&);
+
+   Ring& LocalRing();
+   void Drain();
+
+   std::mutex mutex;                              // guards the names, rings and histograms
+   std::vector<std::string> names;
+   std::vector<std::unique_ptr<Ring> > rings;     // one per thread, they live as long as the process
+   Histogram histograms[MAX_PROBES];
+   std::atomic<int64_t> counters[MAX_PROBES];
+   std::atomic<uint64_t> dropped;
+};
+
+/**
+ * @class ScopedTimer Profiler.hpp <avr/core/Profiler.hpp>
+ * @brief Records the time between its construction and destruction in the Profiler
+ */
+class ScopedTimer {
+public:
+   explicit ScopedTimer(size_t probe) : probe(probe), start(std::chrono::steady_clock::now()) {/* ctor */}
+   ~ScopedTimer() {
+      auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start);
+      Profiler::Instance().Record(this->probe, elapsed.count());
+   }
+
+private:
+   ScopedTimer(const ScopedTimer&);
+   ScopedTimer& operator = (const ScopedTimer&);
+
+   size_t probe;
+   std::chrono::steady_clock::time_point start;
+};
+
+} // namespace avr
+
+#endif // __cplusplus
+
+#endif // AVR_PROFILER_HPP
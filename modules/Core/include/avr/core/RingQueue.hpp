@@ -0,0 +1,51 @@
+#ifndef AVR_RING_QUEUE_HPP
+#define AVR_RING_QUEUE_HPP
+
+#ifdef __cplusplus
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+namespace avr {
+
+/**
+ * @class RingQueue RingQueue.hpp <avr/core/RingQueue.hpp>
+ * @brief Bounded lock-free queue for one producer thread and one consumer thread
+ *
+ * The slots are allocated once, Push and Pop only copy the elements and never block, they fail when the queue
+ * is full or empty respectively. A popped slot is reset to a default element, so it does not keep shared buffers alive.
+ */
+template <typename T>
+class RingQueue {
+public:
+   //! @param capacity Maximum number of elements, it is rounded up to a power of two
+   explicit RingQueue(size_t capacity);
+
+   //! Appends a copy of the element, only the producer thread calls it @return false if the queue is full
+   bool Push(const T&);
+   //! Removes the oldest element, only the consumer thread calls it @return false if the queue is empty
+   bool Pop(T&);
+
+   //! @return The number of elements at the call moment, it may be called by any thread
+   size_t Size() const;
+   //! @return The maximum number of elements
+   size_t Capacity() const { return this->slots.size(); }
+
+private:
+   RingQueue(const RingQueue&);
+   RingQueue& operator = (const RingQueue&);
+
+   std::vector<T> slots;
+   size_t mask;
+   std::atomic<size_t> head;   // next position to pop, written by the consumer
+   std::atomic<size_t> tail;   // next position to push, written by the producer
+};
+
+} // namespace avr
+
+#endif // __cplusplus
+
+#include "impl/RingQueue.tcc"
+
+#endif // AVR_RING_QUEUE_HPP
@@ -0,0 +1,60 @@
+#ifndef AVR_THREAD_POOL_HPP
+#define AVR_THREAD_POOL_HPP
+
+#ifdef __cplusplus
+
+#include <queue>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <future>
+#include <functional>
+#include <condition_variable>
+
+namespace avr {
+
+/**
+ * @class ThreadPool ThreadPool.hpp <avr/core/ThreadPool.hpp>
+ * @brief Fixed set of worker threads that runs submitted tasks in FIFO order
+ *
+ * Each task result (or exception) is delivered by a std::future, so the caller chooses when to wait for it.
+ * The destructor runs all pending tasks before joining the workers.
+ *
+ * @note avr::SPtr has a non-atomic reference counter, a task must not copy or release an SPtr that is
+ *    also used by other thread while it runs.
+ */
+class ThreadPool {
+public:
+   //! Creates the workers, 0 means one worker per hardware thread
+   explicit ThreadPool(size_t threads = 0);
+   //! Waits all pending tasks and joins the workers
+   ~ThreadPool();
+
+   //! Queues a callable without arguments @return The future of its result
+   template <typename F>
+   std::future<typename std::result_of<F()>::type> Submit(F task);
+
+   //! @return The number of workers
+   size_t Size() const { return this->workers.size(); }
+
+private:
+   ThreadPool(const ThreadPool&);
+   ThreadPool& operator = (const ThreadPool&);
+
+   void Work();
+
+   std::vector<std::thread> workers;
+   std::queue<std::function<void()> > tasks;
+
+   std::mutex mutex;
+   std::condition_variable cond;
+   bool stop;
+};
+
+} // namespace avr
+
+#endif // __cplusplus
+
+#include "impl/ThreadPool.tcc"
+
+#endif // AVR_THREAD_POOL_HPP
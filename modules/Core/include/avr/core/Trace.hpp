@@ -0,0 +1,129 @@
+#ifndef AVR_TRACE_HPP
+#define AVR_TRACE_HPP
+
+#ifdef __cplusplus
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <cstdint>
+
+/** @def AVR_TRACE_SCOPE macro function: it records the enclosing scope as a span of the trace, if the tracer is enabled
+ *  Usage: AVR_TRACE_SCOPE("Detect");
+ *  The span is tagged with the frame and the marker of the calling thread, see Tracer::SetFrame and AVR_TRACE_MARKER.
+ *  The name must be a string literal, only its pointer is kept.
+ *
+ *  @def AVR_TRACE_MARKER macro function: it tags the spans of the enclosing scope with a marker ID
+ *  Usage: AVR_TRACE_MARKER(marker.GetID());
+ */
+#define AVR_TRACE_CAT_(a, b) a##b
+#define AVR_TRACE_CAT(a, b) AVR_TRACE_CAT_(a, b)
+#define AVR_TRACE_SCOPE( name ) avr::TraceScope AVR_TRACE_CAT(avr_trace_, __LINE__)(name)
+#define AVR_TRACE_MARKER( id ) avr::TraceMarker AVR_TRACE_CAT(avr_trace_marker_, __LINE__)(id)
+
+namespace avr {
+
+/**
+ * @class Tracer Trace.hpp <avr/core/Trace.hpp>
+ * @brief Records the spans of the pipeline stages and writes them as Chrome Trace Event JSON (chrome://tracing, Perfetto)
+ *
+ * Each thread records into its own circular buffer, so the memory is bounded and the oldest spans are overwritten.
+ * Only the spans of the last seconds given to Enable are written. While it is disabled a span costs a single atomic load.
+ */
+class Tracer {
+public:
+   enum { CAPACITY = 16384 };   // spans kept per thread
+
+   static Tracer& Instance();
+
+   //! Starts recording, it keeps the spans of the last given seconds
+   void Enable(double seconds = 10.0);
+   //! Stops recording, the recorded spans are kept until the next Enable
+   void Disable() { this->enabled.store(false); }
+   bool Enabled() const { return this->enabled.load(std::memory_order_relaxed); }
+
+   //! Writes the recent spans of all threads @return false if the file was not written
+   bool Write(const std::string& path);
+   void Write(std::ostream&);
+
+   //! Records a span of the calling thread, the times are in nanoseconds since Now() origin
+   void Record(const char* name, int64_t start, int64_t duration);
+   //! @return The nanoseconds since the tracer was created
+   int64_t Now() const;
+
+   //! Tags the next spans of the calling thread with a frame number
+   static void SetFrame(size_t frame);
+   static long GetFrame();
+   //! Tags the next spans of the calling thread with a marker ID, -1 means none
+   static void SetMarker(long marker);
+   static long GetMarker();
+   //! Names the calling thread in the trace
+   void SetThreadName(const std::string& name);
+
+private:
+   struct Span {
+      const char* name;
+      int64_t start, duration;
+      long frame, marker;
+   };
+   struct Buffer {
+      std::mutex mutex;       // only contended while the trace is written
+      std::vector<Span> spans;
+      size_t next;
+      size_t tid;
+      std::string name;
+   };
+
+   Tracer();
+   Tracer(const Tracer&);
+   Tracer& operator = (const Tracer&);
+
+   Buffer& LocalBuffer();
+
+   std::mutex mutex;                                 // guards the buffers list
+   std::vector<std::unique_ptr<Buffer> > buffers;    // one per thread, they live as long as the process
+   std::atomic<bool> enabled;
+   std::atomic<int64_t> window;                      // nanoseconds
+   std::chrono::steady_clock::time_point origin;
+};
+
+//! Span of the trace from its construction to its destruction
+class TraceScope {
+public:
+   explicit TraceScope(const char* name) : name(name), start(-1) {
+      if(Tracer::Instance().Enabled()) this->start = Tracer::Instance().Now();
+   }
+   ~TraceScope() {
+      if(this->start >= 0) Tracer::Instance().Record(this->name, this->start, Tracer::Instance().Now() - this->start);
+   }
+
+private:
+   TraceScope(const TraceScope&);
+   TraceScope& operator = (const TraceScope&);
+
+   const char* name;
+   int64_t start;
+};
+
+//! Marker tag of the spans from its construction to its destruction, the previous tag is restored
+class TraceMarker {
+public:
+   explicit TraceMarker(size_t marker) : previous(Tracer::GetMarker()) { Tracer::SetMarker(long(marker)); }
+   ~TraceMarker() { Tracer::SetMarker(this->previous); }
+
+private:
+   TraceMarker(const TraceMarker&);
+   TraceMarker& operator = (const TraceMarker&);
+
+   long previous;
+};
+
+} // namespace avr
+
+#endif // __cplusplus
+
+#endif // AVR_TRACE_HPP
@@ -0,0 +1,51 @@
+#ifndef AVR_RING_QUEUE_TCC
+#define AVR_RING_QUEUE_TCC
+
+#ifdef __cplusplus
+
+namespace avr {
+
+template <typename T>
+RingQueue<T>::RingQueue(size_t capacity) : slots(), mask(0), head(0), tail(0) {
+   size_t size = 1;
+   while(size < capacity) size <<= 1;
+   this->slots.resize(size);
+   this->mask = size - 1;
+}
+
+template <typename T>
+bool RingQueue<T>::Push(const T& element) {
+   size_t t = this->tail.load(std::memory_order_relaxed);
+   if(t - this->head.load(std::memory_order_acquire) == this->slots.size())
+      return false;
+   this->slots[t & this->mask] = element;
+   // publishes the element only after it is written
+   this->tail.store(t + 1, std::memory_order_release);
+   return true;
+}
+
+template <typename T>
+bool RingQueue<T>::Pop(T& element) {
+   size_t h = this->head.load(std::memory_order_relaxed);
+   if(h == this->tail.load(std::memory_order_acquire))
+      return false;
+   T& slot = this->slots[h & this->mask];
+   element = slot;
+   slot = T();
+   // releases the slot only after it is read
+   this->head.store(h + 1, std::memory_order_release);
+   return true;
+}
+
+template <typename T>
+size_t RingQueue<T>::Size() const {
+   size_t h = this->head.load(std::memory_order_acquire);
+   size_t t = this->tail.load(std::memory_order_acquire);
+   return t - h;
+}
+
+} // namespace avr
+
+#endif // __cplusplus
+
+#endif // AVR_RING_QUEUE_TCC
@@ -0,0 +1,35 @@
+#ifndef AVR_THREAD_POOL_TCC
+#define AVR_THREAD_POOL_TCC
+
+#ifndef AVR_CORE_HANDLING_HPP
+    #include <avr/core/Handling.hpp>
+#endif // AVR_CORE_HANDLING_HPP
+
+#ifdef __cplusplus
+
+#include <memory>
+
+namespace avr {
+
+template <typename F>
+std::future<typename std::result_of<F()>::type> ThreadPool::Submit(F task) {
+   typedef typename std::result_of<F()>::type Result;
+
+   // std::function requires a copyable callable, so the packaged task is shared
+   std::shared_ptr<std::packaged_task<Result()> > job = std::make_shared<std::packaged_task<Result()> >(task);
+   std::future<Result> result = job->get_future();
+   {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      if(this->stop)
+         AVR_ERROR(Cod::Undefined, "The thread pool is stopped");
+      this->tasks.push([job]() { (*job)(); });
+   }
+   this->cond.notify_one();
+   return result;
+}
+
+} // namespace avr
+
+#endif // __cplusplus
+
+#endif // AVR_THREAD_POOL_TCC
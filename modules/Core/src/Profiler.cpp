@@ -0,0 +1,131 @@
+#include <avr/core/Profiler.hpp>
+#include <avr/core/Handling.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __cplusplus
+
+namespace avr {
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Histogram                                                                  *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+void Histogram::Add(int64_t nanoseconds) {
+   int64_t micro = nanoseconds / 1000;
+   size_t k = 0;
+   while(micro > 1 && k < BUCKETS - 1) {
+      micro >>= 1;
+      k++;
+   }
+   this->buckets[k]++;
+   this->min = (this->count == 0) ? nanoseconds : std::min(this->min, nanoseconds);
+   this->max = (this->count == 0) ? nanoseconds : std::max(this->max, nanoseconds);
+   this->total += nanoseconds;
+   this->count++;
+}
+
+void Histogram::Clear() {
+   this->count = 0;
+   this->total = this->min = this->max = 0;
+   std::fill(this->buckets, this->buckets + BUCKETS, 0);
+}
+
+double Histogram::Percentile(double p) const {
+   if(this->count == 0) return 0.0;
+   uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p / 100.0 * this->count)));
+   uint64_t seen = 0;
+   for(size_t k = 0; k < BUCKETS; k++) {
+      seen += this->buckets[k];
+      // the bucket bound never exceeds the largest sample
+      if(seen >= rank) return std::min<double>((2 << k) / 1000.0, this->max / 1e6);
+   }
+   return this->max / 1e6;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Profiler                                                                   *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+Profiler::Profiler() : dropped(0) {
+   for(auto& counter : this->counters)
+      counter.store(0);
+}
+
+Profiler& Profiler::Instance() {
+   static Profiler profiler;
+   return profiler;
+}
+
+size_t Profiler::Register(const std::string& name) {
+   std::unique_lock<std::mutex> lock(this->mutex);
+   auto it = std::find(this->names.begin(), this->names.end(), name);
+   if(it != this->names.end())
+      return it - this->names.begin();
+
+   if(this->names.size() == MAX_PROBES)
+      AVR_ERROR(Cod::Undefined, "There are too many profiler probes");
+   this->names.push_back(name);
+   return this->names.size() - 1;
+}
+
+Profiler::Ring& Profiler::LocalRing() {
+   static thread_local Ring* ring = nullptr;
+   if(ring == nullptr) {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->rings.push_back(std::unique_ptr<Ring>(new Ring(RING_SIZE)));
+      ring = this->rings.back().get();
+   }
+   return *ring;
+}
+
+void Profiler::Record(size_t probe, int64_t nanoseconds) {
+   Sample sample = { uint32_t(probe), nanoseconds };
+   if(!this->LocalRing().Push(sample))
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+// the mutex is held, so there is a single consumer of each ring
+void Profiler::Drain() {
+   Sample sample;
+   for(auto& ring : this->rings)
+      while(ring->Pop(sample))
+         this->histograms[sample.probe].Add(sample.nanoseconds);
+}
+
+std::vector<ProbeStats> Profiler::Collect() {
+   std::unique_lock<std::mutex> lock(this->mutex);
+   this->Drain();
+
+   std::vector<ProbeStats> stats(this->names.size());
+   for(size_t i = 0; i < this->names.size(); i++) {
+      const Histogram& hist = this->histograms[i];
+      ProbeStats& out = stats[i];
+      out.name = this->names[i];
+      out.count = hist.count;
+      out.counter = uint64_t(this->counters[i].load());
+      out.total = hist.total / 1e6;
+      out.mean = (hist.count > 0) ? out.total / hist.count : 0.0;
+      out.min = hist.min / 1e6;
+      out.max = hist.max / 1e6;
+      out.p50 = hist.Percentile(50);
+      out.p95 = hist.Percentile(95);
+      out.p99 = hist.Percentile(99);
+   }
+   return stats;
+}
+
+void Profiler::Reset() {
+   std::unique_lock<std::mutex> lock(this->mutex);
+   this->Drain();
+   for(auto& hist : this->histograms)
+      hist.Clear();
+   for(auto& counter : this->counters)
+      counter.store(0);
+   this->dropped.store(0);
+}
+
+} // namespace avr
+
+#endif // __cplusplus
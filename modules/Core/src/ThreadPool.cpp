@@ -0,0 +1,45 @@
+#include <avr/core/ThreadPool.hpp>
+
+#include <algorithm>
+
+#ifdef __cplusplus
+
+namespace avr {
+
+ThreadPool::ThreadPool(size_t threads) : stop(false) {
+   if(threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+
+   this->workers.reserve(threads);
+   for(size_t i = 0; i < threads; i++)
+      this->workers.push_back(std::thread(&ThreadPool::Work, this));
+}
+
+ThreadPool::~ThreadPool() {
+   {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->stop = true;
+   }
+   this->cond.notify_all();
+   for(auto& worker : this->workers)
+      worker.join();
+}
+
+void ThreadPool::Work() {
+   for(;;) {
+      std::function<void()> task;
+      {
+         std::unique_lock<std::mutex> lock(this->mutex);
+         this->cond.wait(lock, [this]() { return this->stop || !this->tasks.empty(); });
+         // the pending tasks still run after stop
+         if(this->tasks.empty()) return;
+         task = std::move(this->tasks.front());
+         this->tasks.pop();
+      }
+      task();
+   }
+}
+
+} // namespace avr
+
+#endif // __cplusplus
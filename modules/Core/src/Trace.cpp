@@ -0,0 +1,103 @@
+#include <avr/core/Trace.hpp>
+
+#include <fstream>
+
+#ifdef __cplusplus
+
+namespace avr {
+
+namespace {
+
+thread_local long currentFrame = -1;
+thread_local long currentMarker = -1;
+
+} // namespace
+
+Tracer::Tracer() : enabled(false), window(0), origin(std::chrono::steady_clock::now()) {/* ctor */}
+
+Tracer& Tracer::Instance() {
+   static Tracer tracer;
+   return tracer;
+}
+
+void Tracer::Enable(double seconds) {
+   this->window.store(int64_t(seconds * 1e9));
+   this->enabled.store(true);
+}
+
+int64_t Tracer::Now() const {
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->origin).count();
+}
+
+void Tracer::SetFrame(size_t frame) { currentFrame = long(frame); }
+long Tracer::GetFrame()             { return currentFrame; }
+void Tracer::SetMarker(long marker) { currentMarker = marker; }
+long Tracer::GetMarker()            { return currentMarker; }
+
+Tracer::Buffer& Tracer::LocalBuffer() {
+   static thread_local Buffer* buffer = nullptr;
+   if(buffer == nullptr) {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->buffers.push_back(std::unique_ptr<Buffer>(new Buffer()));
+      buffer = this->buffers.back().get();
+      buffer->spans.reserve(CAPACITY);
+      buffer->next = 0;
+      buffer->tid = this->buffers.size();
+   }
+   return *buffer;
+}
+
+void Tracer::SetThreadName(const std::string& name) {
+   Buffer& buffer = this->LocalBuffer();
+   std::unique_lock<std::mutex> lock(buffer.mutex);
+   buffer.name = name;
+}
+
+void Tracer::Record(const char* name, int64_t start, int64_t duration) {
+   Span span = { name, start, duration, currentFrame, currentMarker };
+   Buffer& buffer = this->LocalBuffer();
+   std::unique_lock<std::mutex> lock(buffer.mutex);
+   if(buffer.spans.size() < CAPACITY)
+      buffer.spans.push_back(span);
+   else
+      buffer.spans[buffer.next] = span;
+   buffer.next = (buffer.next + 1) % CAPACITY;
+}
+
+void Tracer::Write(std::ostream& out) {
+   int64_t since = this->Now() - this->window.load();
+   bool first = true;
+
+   out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+   std::unique_lock<std::mutex> lock(this->mutex);
+   for(auto& buffer : this->buffers) {
+      std::unique_lock<std::mutex> guard(buffer->mutex);
+      if(!buffer->name.empty()) {
+         out << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid
+             << ", \"args\": {\"name\": \"" << buffer->name << "\"}}";
+         first = false;
+      }
+      for(const auto& span : buffer->spans) {
+         if(span.start < since) continue;
+         out << (first ? "" : ",") << "\n{\"name\": \"" << span.name << "\", \"cat\": \"avr\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+             << buffer->tid << ", \"ts\": " << (span.start / 1000.0) << ", \"dur\": " << (span.duration / 1000.0) << ", \"args\": {";
+         if(span.frame >= 0) out << "\"frame\": " << span.frame;
+         if(span.marker >= 0) out << (span.frame >= 0 ? ", " : "") << "\"marker\": " << span.marker;
+         out << "}}";
+         first = false;
+      }
+   }
+   out << "\n]}\n";
+}
+
+bool Tracer::Write(const std::string& path) {
+   std::ofstream file(path.c_str());
+   if(!file.is_open()) return false;
+   file.precision(15);
+   this->Write(file);
+   return file.good();
+}
+
+} // namespace avr
+
+#endif // __cplusplus
@@ -10,8 +10,17 @@
 #define AVR_ALGORITHMS_HPP
 
 #include <avr/core/Core.hpp>
+#include <avr/core/Trace.hpp>
+#include <avr/core/ThreadPool.hpp>
 #include "Feature.hpp"
 
+// OpenCV engines owned by the wrappers below, they are only instantiated on Algorithms.cpp
+namespace cv {
+class FeatureDetector;
+class DescriptorExtractor;
+class DescriptorMatcher;
+class Feature2D;
+}
 
 namespace avr {
 
@@ -20,6 +29,7 @@ using std::vector;
 // base classes in this file
 class FeatureDetector;
 class DescriptorExtractor;
+class FeatureEngine;
 class DescriptorMatcher;
 class OpticFlowAlgorithm;
 // class for system algorithms setup
@@ -39,6 +49,11 @@ public:
     * @param keys [out] Detected keypoints in the image.
     */
    virtual void operator() (const Mat& image, vector<cv::KeyPoint>& keys) const = 0;
+   /**
+    * @return The name and the parameters of the detector, two detectors with the same configuration find the same keypoints.
+    *    The default is the class name given by the compiler, the detectors with parameters should override it.
+    */
+   virtual std::string Config() const;
 };
 
 /**
@@ -51,15 +66,19 @@ public:
     * @param _nOctaves     Number of detection octaves, use 0 to do single scale.
     * @param _patternScale Apply this scale to the pattern used for sampling the neighbourhood of a keypoint.
     */
-   BRISKDetector(int _threshold=30, int _nOctaves=3, float _patternScale=1.0f) : FeatureDetector(),
-      threshold(_threshold), nOctaves(_nOctaves), patternScale(_patternScale) {/* ctor */}
+   BRISKDetector(int _threshold=30, int _nOctaves=3, float _patternScale=1.0f);
+   ~BRISKDetector();
    // detect
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys) const;
+   std::string Config() const;
 
 private:
+   friend class FeatureEngine;
    int threshold;
    int nOctaves;
    float patternScale;
+
+   SPtr<cv::FeatureDetector> engine;
 };
 
 /**
@@ -71,14 +90,17 @@ public:
     * @param _threshold Threshold on difference between intensity of the central pixel and pixels of a circle around this pixel.
     * @param _nonmaxSuppression If true, non-maximum suppression is applied to detected corners (keypoints).
     */
-   FASTDetector(int _threshold=10, bool _nonmaxSuppression=true) : FeatureDetector(),
-      threshold(_threshold), nonmaxSuppression(_nonmaxSuppression) {/* ctor */}
+   FASTDetector(int _threshold=10, bool _nonmaxSuppression=true);
+   ~FASTDetector();
    // detect
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys) const;
+   std::string Config() const;
 
 private:
    int threshold;
    bool nonmaxSuppression;
+
+   SPtr<cv::FeatureDetector> engine;
 };
 
 /**
@@ -92,16 +114,20 @@ public:
     * @param _nlevels The number of pyramid levels.
     * @param _edgeThreshold This is size of the border where the features are not detected.
     */
-   ORBDetector(int _nfeatures = 500, float _scaleFactor = 1.2f, int _nlevels = 8, int _edgeThreshold = 31) : FeatureDetector(),
-      nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels), edgeThreshold(_edgeThreshold) {/* ctor */}
+   ORBDetector(int _nfeatures = 500, float _scaleFactor = 1.2f, int _nlevels = 8, int _edgeThreshold = 31);
+   ~ORBDetector();
    // detect
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys) const;
+   std::string Config() const;
 
 private:
+   friend class FeatureEngine;
    int nfeatures;
    float scaleFactor;
    int nlevels;
    int edgeThreshold;
+
+   SPtr<cv::FeatureDetector> engine;
 };
 
 /**
@@ -118,17 +144,19 @@ public:
     * @param _lineThresholdBinarized Yet another threshold for the feature size to eliminate edges.
     *       The larger the 2nd threshold, the more points you get.
     */
-   STARDetector(int _maxSize=45, int _responseThreshold=30, int _lineThresholdProjected=10, int _lineThresholdBinarized=8) : FeatureDetector(),
-      maxSize(_maxSize), responseThreshold(_responseThreshold), lineThresholdProjected(_lineThresholdProjected),
-      lineThresholdBinarized(_lineThresholdBinarized) {/* ctor */}
+   STARDetector(int _maxSize=45, int _responseThreshold=30, int _lineThresholdProjected=10, int _lineThresholdBinarized=8);
+   ~STARDetector();
    // detect
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys) const;
+   std::string Config() const;
 
 private:
    int maxSize;
    int responseThreshold;
    int lineThresholdProjected;
    int lineThresholdBinarized;
+
+   SPtr<cv::FeatureDetector> engine;
 };
 
 /**
@@ -144,17 +172,21 @@ public:
     * @param _edgeTh The threshold used to filter out edge-like features. The larger the threshold more features are retained.
     * @param _sigma The sigma of the Gaussian applied to the input image at the octave #0.
     */
-   SIFTDetector(int _nfeatures=0, int _nOctaveLayers=3, double _contrastTh=0.04, double _edgeTh=10, double _sigma=1.6) : FeatureDetector(),
-      nfeatures(_nfeatures), nOctaveLayers(_nOctaveLayers), contrastThreshold(_contrastTh), edgeThreshold(_edgeTh), sigma(_sigma){/* ctor */}
+   SIFTDetector(int _nfeatures=0, int _nOctaveLayers=3, double _contrastTh=0.04, double _edgeTh=10, double _sigma=1.6);
+   ~SIFTDetector();
    // detect
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys) const;
+   std::string Config() const;
 
 private:
+   friend class FeatureEngine;
    int nfeatures;
    int nOctaveLayers;
    double contrastThreshold;
    double edgeThreshold;
    double sigma;
+
+   SPtr<cv::FeatureDetector> engine;
 };
 
 /**
@@ -168,15 +200,51 @@ public:
     * @param _nOctaves Number of pyramid octaves the keypoint detector will use.
     * @param _nOctaveLayers Number of octave layers within each octave.
     */
-   SURFDetector(double _hessianThreshold = 400.0, int _nOctaves=4, int _nOctaveLayers=2) : FeatureDetector(),
-      hessianThreshold(_hessianThreshold), nOctaves(_nOctaves), nOctaveLayers(_nOctaveLayers) {/* ctor */}
+   SURFDetector(double _hessianThreshold = 400.0, int _nOctaves=4, int _nOctaveLayers=2);
+   ~SURFDetector();
    // detect
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys) const;
+   std::string Config() const;
 
 private:
+   friend class FeatureEngine;
    double hessianThreshold;
    int nOctaves;
    int nOctaveLayers;
+
+   SPtr<cv::FeatureDetector> engine;
+};
+
+/**
+ * Adapter that runs another detector on overlapping tiles of the image in parallel, so the detection scales with the cores.
+ * Each tile is also a cell of the keypoints budget: only its strongest keypoints are kept, so they are spread over the
+ * image instead of clustered on its textured regions. The overlap is only the context of the detector around the cell
+ * borders, each tile keeps the keypoints inside its own cell, so a feature found by two tiles is kept once.
+ */
+class TiledDetector : public FeatureDetector {
+public:
+   /**
+    * @param _detector Detector of each tile, it must be safe to call from different threads
+    * @param _cols, _rows Number of tiles on each direction
+    * @param _perCell Maximum number of keypoints kept by each tile, by their response. Use 0 to keep all of them.
+    * @param _overlap Pixels that each tile extends over its neighbours, about the detector border
+    * @param _threads Number of threads of the pool, 0 means one per hardware thread
+    */
+   TiledDetector(const SPtr<FeatureDetector>& _detector, int _cols = 4, int _rows = 4, size_t _perCell = 64,
+                 int _overlap = 32, size_t _threads = 0);
+   ~TiledDetector();
+   // detect
+   void operator() (const Mat& image, vector<cv::KeyPoint>& keys) const;
+   std::string Config() const;
+
+private:
+   SPtr<FeatureDetector> detector;
+   int cols;
+   int rows;
+   size_t perCell;
+   int overlap;
+
+   mutable SPtr<ThreadPool> pool;   // its Submit is thread safe, so the detector stays const
 };
 
 /*----------------------------------------------------------------------------------------------------------------------------*\
@@ -194,6 +262,11 @@ public:
     * @param descriptors [out] Computed descriptor for each keypoint.
     */
    virtual void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& descriptors) const = 0;
+   /**
+    * @return The name, the parameters and the descriptor format (type and columns) of the extractor.
+    *    The default is the class name given by the compiler, the extractors with parameters should override it.
+    */
+   virtual std::string Config() const;
 };
 
 /**
@@ -202,13 +275,16 @@ public:
 class BRIEFExtractor : public DescriptorExtractor {
 public:
    //! @param bytes is a length of descriptor in bytes. It can be equal 16, 32 or 64 bytes.
-   BRIEFExtractor(int _bytes = 32) : DescriptorExtractor(),
-      bytes(_bytes) {/* ctor */}
+   BRIEFExtractor(int _bytes = 32);
+   ~BRIEFExtractor();
    // extract
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const;
+   std::string Config() const;
 
 private:
    int bytes;
+
+   SPtr<cv::DescriptorExtractor> engine;
 };
 
 /**
@@ -217,13 +293,17 @@ private:
 class BRISKExtractor : public DescriptorExtractor {
 public:
    //! @param _patternScale Apply this scale to the pattern used for sampling the neighbourhood of a keypoint.
-   BRISKExtractor(float _patternScale=1.0f) : DescriptorExtractor(),
-      patternScale(_patternScale) {/* ctor */}
+   BRISKExtractor(float _patternScale=1.0f);
+   ~BRISKExtractor();
    // extract
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const;
+   std::string Config() const;
 
 private:
+   friend class FeatureEngine;
    float patternScale;
+
+   SPtr<cv::DescriptorExtractor> engine;
 };
 
 /**
@@ -235,14 +315,18 @@ public:
     * @param _WTA_K The number of points that produce each element of the oriented BRIEF descriptor.
     * @param _patchSize Size of the patch used by oriented BRIEF descriptor.
     */
-   ORBExtractor(int _WTA_K=2, int _patchSize=31) : DescriptorExtractor(),
-      WTA_K(_WTA_K), patchSize(_patchSize) {/* ctor */}
+   ORBExtractor(int _WTA_K=2, int _patchSize=31);
+   ~ORBExtractor();
    // extract
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const;
+   std::string Config() const;
 
 private:
+   friend class FeatureEngine;
    int WTA_K;
    int patchSize;
+
+   SPtr<cv::DescriptorExtractor> engine;
 };
 
 /**
@@ -250,9 +334,14 @@ private:
  */
 class SIFTExtractor : public DescriptorExtractor {
 public:
-   SIFTExtractor() : DescriptorExtractor() {/* ctor */}
+   SIFTExtractor();
+   ~SIFTExtractor();
    // extract
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const;
+   std::string Config() const;
+
+private:
+   SPtr<cv::DescriptorExtractor> engine;
 };
 
 /**
@@ -261,19 +350,123 @@ public:
 class SURFExtractor : public DescriptorExtractor {
 public:
    //! @param _extended Extended descriptor flag (true - use 128-element descriptor; false use 64-element descriptor).
-   SURFExtractor(bool _extended = false) : DescriptorExtractor(),
-      extended(_extended) {/* ctor */}
+   SURFExtractor(bool _extended = false);
+   ~SURFExtractor();
    // extract
    void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const;
+   std::string Config() const;
 
 private:
+   friend class FeatureEngine;
    bool extended;
+
+   SPtr<cv::DescriptorExtractor> engine;
+};
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Feature Engines                                                            *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+/**
+ * @brief Abstract base class for the algorithms that detect keypoints and extract their descriptors in a single pass.
+ *
+ * The detector and the extractor of SIFT, SURF, ORB and BRISK build the same scale space (or integral image), so their
+ * separate calls build it twice. The engine of a pair builds it once, see Fuse.
+ */
+class FeatureEngine {
+public:
+   virtual ~FeatureEngine() {/* dtor */}
+   /**
+    * Detect and extract
+    * @param image [in] The image.
+    * @param keys [out] Detected keypoints in the image.
+    * @param descriptors [out] Computed descriptor for each keypoint.
+    */
+   virtual void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& descriptors) const = 0;
+
+   /**
+    * @return The engine with the parameters of both algorithms when they are a pair of the same method (e.g. SIFTDetector
+    *    and SIFTExtractor), or a null pointer when they may not be fused
+    */
+   static SPtr<FeatureEngine> Fuse(const SPtr<FeatureDetector>& detector, const SPtr<DescriptorExtractor>& extractor);
+};
+
+/**
+ * Binary Robust Invariant Scalable Keypoints (BRISK) algorithm, by Leutenegger et al. (2011)
+ */
+class BRISKEngine : public FeatureEngine {
+public:
+   //! @see BRISKDetector and BRISKExtractor for the parameters
+   BRISKEngine(int _threshold=30, int _nOctaves=3, float _patternScale=1.0f);
+   ~BRISKEngine();
+   // detect and extract
+   void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const;
+
+private:
+   SPtr<cv::Feature2D> engine;
+};
+
+/**
+ * ORB (ORiented Brief) algorithm, by Rublee et al. (2011)
+ */
+class ORBEngine : public FeatureEngine {
+public:
+   //! @see ORBDetector and ORBExtractor for the parameters
+   ORBEngine(int _nfeatures = 500, float _scaleFactor = 1.2f, int _nlevels = 8, int _edgeThreshold = 31, int _WTA_K=2, int _patchSize=31);
+   ~ORBEngine();
+   // detect and extract
+   void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const;
+
+private:
+   SPtr<cv::Feature2D> engine;
+};
+
+/**
+ * Scale Invariant Features Transform (SIFT) algorithm, by D. Lowe (2004)
+ */
+class SIFTEngine : public FeatureEngine {
+public:
+   //! @see SIFTDetector for the parameters
+   SIFTEngine(int _nfeatures=0, int _nOctaveLayers=3, double _contrastTh=0.04, double _edgeTh=10, double _sigma=1.6);
+   ~SIFTEngine();
+   // detect and extract
+   void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const;
+
+private:
+   SPtr<cv::Feature2D> engine;
+};
+
+/**
+ * Speeded Up Robust Features (SURF) algorithm, by H. Bay et al (2006)
+ */
+class SURFEngine : public FeatureEngine {
+public:
+   //! @see SURFDetector and SURFExtractor for the parameters
+   SURFEngine(double _hessianThreshold = 400.0, int _nOctaves=4, int _nOctaveLayers=2, bool _extended = false);
+   ~SURFEngine();
+   // detect and extract
+   void operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const;
+
+private:
+   SPtr<cv::Feature2D> engine;
 };
 
 /*----------------------------------------------------------------------------------------------------------------------------*\
 *                                                 Descriptor Matchers                                                          *
 \*----------------------------------------------------------------------------------------------------------------------------*/
 
+/**
+ * Query descriptors prepared once by a matcher to be matched against many train sets (e.g. a marker against each frame).
+ * The base class only keeps the descriptors, matchers may extend it with data that does not change among the frames.
+ */
+class MatchIndex {
+public:
+   explicit MatchIndex(const Mat& descriptors) : descriptors(descriptors) {/* ctor */}
+   virtual ~MatchIndex() {/* dtor */}
+
+   const Mat descriptors;
+};
+
 //! Abstract base class for matching two sets of descriptors.
 class DescriptorMatcher {
 public:
@@ -285,9 +478,21 @@ public:
     * @param matches [out] The best matchings between each pair of descriptors.
     */
    virtual void operator() (const Mat& query, const Mat& train, vector<cv::DMatch>& matches) const = 0;
-
-private:
-
+   /**
+    * Match with prepared query descriptors, by default it is the same of match the raw descriptors
+    * @param query [in] Query descriptor prepared by this matcher, see DescriptorMatcher::Index.
+    * @param train [in] Train descriptor (scene's features).
+    * @param matches [out] The best matchings between each pair of descriptors.
+    */
+   virtual void operator() (const MatchIndex& query, const Mat& train, vector<cv::DMatch>& matches) const {
+      (*this)(query.descriptors, train, matches);
+   }
+   //! Prepares query descriptors that will be matched many times, see MatchIndex
+   virtual SPtr<MatchIndex> Index(const Mat& query) const {
+      return new MatchIndex(query);
+   }
+   //! @return true if Index builds a search index, so a match costs about the same for many query descriptors as for a few
+   virtual bool Searched() const { return false; }
 };
 
 /**
@@ -303,24 +508,80 @@ public:
     *    the j-th scene descriptor is the nearest and vice versa, i.e will only return consistent pairs.
     *    Such technique usually produces best results with minimal number of outliers when there are enough matches.
     */
-   BruteForceMatcher(int _normType, bool _crossCheck = false) : DescriptorMatcher(),
-      normType(_normType), crossCheck(_crossCheck) {/* ctor */}
+   BruteForceMatcher(int _normType, bool _crossCheck = false);
+   ~BruteForceMatcher();
    // match
    void operator() (const Mat& query, const Mat& train, vector<cv::DMatch>& matches) const;
 
 private:
    int normType;
    bool crossCheck;
+
+   SPtr<cv::DescriptorMatcher> engine;
+};
+
+/**
+ * Brute force matcher specialized in binary descriptors (ORB, BRISK and BRIEF) under Hamming distance.
+ * For each query descriptor it finds the two nearest train descriptors and applies the ratio test in the same pass.
+ * Popcount kernels are chosen at runtime (scalar, SSE4.2 or AVX2) and the query descriptors are splitted among the cores.
+ */
+class HammingMatcher : public DescriptorMatcher {
+public:
+   //! @param _ratio Maximum ratio between the distances to the first and to the second nearest neighbours of a good match
+   HammingMatcher(float _ratio = 0.7f) : DescriptorMatcher(),
+      ratio(_ratio) {/* ctor */}
+   // match
+   void operator() (const Mat& query, const Mat& train, vector<cv::DMatch>& matches) const;
+
+private:
+   float ratio;
+};
+
+/**
+ * Brute force matcher specialized in float descriptors (SIFT and SURF) under L2 or L1 distance.
+ * For each query descriptor it finds the two nearest train descriptors and applies the ratio test in the same pass.
+ * L2 distances are computed by ||q||^2 + ||t||^2 - 2q.t, where the products come from the blocked matrix multiply (cv::gemm)
+ * and the query norms are computed once by FloatMatcher::Index. L1 distances use an AVX2 kernel when the CPU supports it.
+ */
+class FloatMatcher : public DescriptorMatcher {
+public:
+   /**
+    * @param _normType One of NORM_L1 or NORM_L2.
+    * @param _ratio Maximum ratio between the distances to the first and to the second nearest neighbours of a good match
+    */
+   FloatMatcher(int _normType, float _ratio = 0.7f);
+   // match
+   void operator() (const Mat& query, const Mat& train, vector<cv::DMatch>& matches) const;
+   void operator() (const MatchIndex& query, const Mat& train, vector<cv::DMatch>& matches) const;
+   // prepare query, computes its squared norms on L2
+   SPtr<MatchIndex> Index(const Mat& query) const;
+
+private:
+   int normType;
+   float ratio;
 };
 
 /**
  * The Flann based matcher by Muja and Lowe (2009)
+ *
+ * Prepared query descriptors (see FlannBasedMatcher::Index) keep a search index built only once, a randomized k-d forest
+ * for float descriptors or a multi-probe LSH for binary descriptors, then each match only pays the search cost.
+ * In this case the nearest query descriptor is searched for each train descriptor, but the output matches keep
+ * the same meaning of queryIdx and trainIdx.
  */
 class FlannBasedMatcher : public DescriptorMatcher {
 public:
-   FlannBasedMatcher() : DescriptorMatcher() {/* ctor */}
+   FlannBasedMatcher();
+   ~FlannBasedMatcher();
    // match
    void operator() (const Mat& query, const Mat& train, vector<cv::DMatch>& matches) const;
+   void operator() (const MatchIndex& query, const Mat& train, vector<cv::DMatch>& matches) const;
+   // prepare query, builds its search index
+   SPtr<MatchIndex> Index(const Mat& query) const;
+   bool Searched() const { return true; }
+
+private:
+   SPtr<cv::DescriptorMatcher> engine;
 };
 
 /*----------------------------------------------------------------------------------------------------------------------------*\
@@ -342,6 +603,35 @@ public:
    virtual void operator() (const Mat& prevImage, const vector<Point2f>& prevTracked,
                             const Mat& currImage, vector<Point2f>& tracked,
                             vector<float>& error) const = 0;
+   /**
+    * Track with images prepared by Pyramid, the default implementation uses only the first level of each one
+    * @param prevPyramid [in] Pyramid of the previous image
+    * @param currPyramid [in] Pyramid of the current image, built with the same parameters
+    */
+   virtual void operator() (const vector<Mat>& prevPyramid, const vector<Point2f>& prevTracked,
+                            const vector<Mat>& currPyramid, vector<Point2f>& tracked,
+                            vector<float>& error) const {
+      (*this) (prevPyramid[0], prevTracked, currPyramid[0], tracked, error);
+   }
+   /**
+    * Track from predicted positions, e.g. given by the motion of the last frames
+    * @param tracked [inout] Predicted positions as input, the new positions as output
+    * @param motion [in] Largest expected distance in pixels between the predicted and the true positions, it may
+    *    shrink the search. The default implementation ignores the prediction.
+    */
+   virtual void operator() (const vector<Mat>& prevPyramid, const vector<Point2f>& prevTracked,
+                            const vector<Mat>& currPyramid, vector<Point2f>& tracked,
+                            vector<float>& error, float motion) const {
+      (*this) (prevPyramid, prevTracked, currPyramid, tracked, error);
+   }
+   /**
+    * Prepares a grayscale image to be tracked, so it is done once per frame instead of once per track
+    * @param image [in] 8-bit grayscale image
+    * @param pyramid [out] Prepared image levels, the default implementation keeps only the image
+    */
+   virtual void Pyramid(const Mat& image, vector<Mat>& pyramid) const {
+      pyramid.assign(1, image);
+   }
 };
 
 /**
@@ -358,6 +648,48 @@ public:
    void operator() (const Mat& prevImage, const vector<Point2f>& prevTracked,
                     const Mat& currImage, vector<Point2f>& tracked,
                     vector<float>& error) const;
+   //! @brief Same as above, but it reuses the pyramids and their derivatives, so none of them is built again
+   void operator() (const vector<Mat>& prevPyramid, const vector<Point2f>& prevTracked,
+                    const vector<Mat>& currPyramid, vector<Point2f>& tracked,
+                    vector<float>& error) const;
+   //! @brief Starts from the given positions, it uses only the pyramid levels needed to cover the expected motion
+   void operator() (const vector<Mat>& prevPyramid, const vector<Point2f>& prevTracked,
+                    const vector<Mat>& currPyramid, vector<Point2f>& tracked,
+                    vector<float>& error, float motion) const;
+   //! @brief Builds the image pyramid with derivatives with the same window and levels used to track
+   void Pyramid(const Mat& image, vector<Mat>& pyramid) const;
+};
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Keypoints Budget                                                           *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+/**
+ * @struct KeypointBudget Algorithms.hpp <avr/track/Algorithms.hpp>
+ * @brief Maximum number of keypoints of a scene frame given to the extractor, and the policy that chooses them
+ *
+ * It bounds the extraction and matching time whatever the scene texture. HybridTracker applies it once to the keypoints
+ * of all the windows searched in a frame, the marker images are not culled. The policies are:
+ *    @li RESPONSE: the strongest keypoints
+ *    @li ANMS: adaptive non-maximal suppression (Brown et al., 2005), the keypoints that are the strongest of the widest
+ *       neighbourhoods, so they are strong and spread
+ *    @li GRID: the strongest keypoints of each cell of a grid, with the same quota per cell
+ */
+struct KeypointBudget {
+   enum Policy { NONE, RESPONSE, ANMS, GRID };
+
+   KeypointBudget(size_t count = 0, Policy policy = RESPONSE, int cols = 8, int rows = 6) :
+      count(count), policy(policy), cols(cols), rows(rows) {/* ctor */}
+
+   //! Keeps at most count keypoints of an image, nothing is done if count is 0 or the policy is NONE
+   void Apply(const Size2i& image, vector<cv::KeyPoint>& keys) const;
+
+   //! @return Whether Apply may cull keypoints
+   bool Active() const { return this->count > 0 && this->policy != NONE; }
+
+   size_t count;
+   Policy policy;
+   int cols, rows;   // grid of the GRID policy
 };
 
 /*----------------------------------------------------------------------------------------------------------------------------*\
@@ -371,6 +703,9 @@ public:
  * This class together with all interfaces present here make the library highly configurable and customizable.
  * It is important to choose a good algotithms combination for a better application's performance, to help in this choice
  * the class provides differents optimization options to build the object.
+ *
+ * @note Each algorithm builds its OpenCV engine only once in its constructor, so the objects held here are long-lived.
+ *    Their operators are const and they may be shared by different threads.
  */
 class SystemAlgorithms {
 public:
@@ -378,17 +713,26 @@ public:
    const SPtr<DescriptorExtractor>  extractor;
    const SPtr<DescriptorMatcher>    matcher;
    const SPtr<OpticFlowAlgorithm>   tracker;
+   const KeypointBudget             budget;
+   const SPtr<FeatureEngine>        engine;   // fused detector and extractor, null if they may not be fused
 
    //! Initialization construtor
    SystemAlgorithms( const SPtr<FeatureDetector>&      detector,
                      const SPtr<DescriptorExtractor>&  extractor,
                      const SPtr<DescriptorMatcher>&    matcher,
-                     const SPtr<OpticFlowAlgorithm>&   tracker
-                  ) : detector(detector), extractor(extractor), matcher(matcher), tracker(tracker) {/* ctor */}
+                     const SPtr<OpticFlowAlgorithm>&   tracker,
+                     const KeypointBudget&             budget = KeypointBudget()
+                  ) : detector(detector), extractor(extractor), matcher(matcher), tracker(tracker), budget(budget),
+                      engine(FeatureEngine::Fuse(detector, extractor)) {/* ctor */}
 
    //! Copy constructor
    SystemAlgorithms(const SystemAlgorithms& system) : detector(system.detector), extractor(system.extractor),
-                                                      matcher(system.matcher), tracker(system.tracker) {/* ctor */}
+                                                      matcher(system.matcher), tracker(system.tracker), budget(system.budget),
+                                                      engine(system.engine) {/* ctor */}
+   //! Copy with other keypoints budget
+   SystemAlgorithms(const SystemAlgorithms& system, const KeypointBudget& budget) : detector(system.detector), extractor(system.extractor),
+                                                      matcher(system.matcher), tracker(system.tracker), budget(budget),
+                                                      engine(system.engine) {/* ctor */}
 
    /**
     * This method creates the object setting the algorithms based on optimization options that are a better performance or a better quality.
@@ -396,23 +740,68 @@ public:
     */
    static SystemAlgorithms Create(bool optimazePerformance, bool optimazeQuality);
 
-   // interface for the algorithms
+   // interface for the algorithms, each call is a span of the trace (see avr::Tracer)
    //! Detects keypoints in image, see FeatureDetector for more details
    void Detect(const Mat& image, vector<cv::KeyPoint>& keys) const {
+      AVR_TRACE_SCOPE("Detect");
       if(this->detector != nullptr) (*this->detector)(image, keys);
    }
    //! Extracts descriptors of image, see DescriptorExtractor for more details
    void Extract(const Mat& image, vector<cv::KeyPoint>& keys, Mat& descriptors) const {
+      AVR_TRACE_SCOPE("Extract");
       if(this->extractor != nullptr) (*this->extractor)(image, keys, descriptors);
    }
+   /**
+    * Detects keypoints in image and extracts their descriptors. The fused engine does both in a single pass when there is one.
+    * The budget is not applied, it has to cull the keypoints of the whole frame between Detect and Extract.
+    */
+   void DetectAndExtract(const Mat& image, vector<cv::KeyPoint>& keys, Mat& descriptors) const {
+      if(this->engine != nullptr) {
+         AVR_TRACE_SCOPE("DetectAndExtract");
+         (*this->engine)(image, keys, descriptors);
+      } else {
+         this->Detect(image, keys);
+         this->Extract(image, keys, descriptors);
+      }
+   }
    //! Matches descriptors of images, see DescriptorMatcher for more details
    void Match(const Mat& query, const Mat& train, vector<cv::DMatch>& matches) const {
+      AVR_TRACE_SCOPE("Match");
       if(this->matcher != nullptr) (*this->matcher) (query, train, matches);
    }
+   //! Matches prepared descriptors with descriptors of an image, see DescriptorMatcher for more details
+   void Match(const MatchIndex& query, const Mat& train, vector<cv::DMatch>& matches) const {
+      AVR_TRACE_SCOPE("Match");
+      if(this->matcher != nullptr) (*this->matcher) (query, train, matches);
+   }
+   //! Prepares descriptors to be matched many times, see DescriptorMatcher::Index
+   SPtr<MatchIndex> Index(const Mat& query) const {
+      return (this->matcher != nullptr) ? this->matcher->Index(query) : SPtr<MatchIndex>(new MatchIndex(query));
+   }
+   //! @return true if the matcher builds a search index, see DescriptorMatcher::Searched
+   bool Searched() const {
+      return this->matcher != nullptr && this->matcher->Searched();
+   }
    //! Tracks a set of image points in another image, see OpticFlowAlgorithm for more details
    void Track(const Mat& prevFrame, const vector<Point2f>& prevTracked, const Mat& currFrame, vector<Point2f>& tracked, vector<float>& error) const {
+      AVR_TRACE_SCOPE("Track");
       if(this->tracker != nullptr) (*this->tracker) (prevFrame, prevTracked, currFrame, tracked, error);
    }
+   //! Tracks a set of image points between two pyramids built by Pyramid
+   void Track(const vector<Mat>& prevPyramid, const vector<Point2f>& prevTracked, const vector<Mat>& currPyramid, vector<Point2f>& tracked, vector<float>& error) const {
+      AVR_TRACE_SCOPE("Track");
+      if(this->tracker != nullptr) (*this->tracker) (prevPyramid, prevTracked, currPyramid, tracked, error);
+   }
+   //! Tracks a set of image points from predicted positions, see OpticFlowAlgorithm for more details
+   void Track(const vector<Mat>& prevPyramid, const vector<Point2f>& prevTracked, const vector<Mat>& currPyramid, vector<Point2f>& tracked, vector<float>& error, float motion) const {
+      AVR_TRACE_SCOPE("Track");
+      if(this->tracker != nullptr) (*this->tracker) (prevPyramid, prevTracked, currPyramid, tracked, error, motion);
+   }
+   //! Prepares a grayscale image to be tracked, see OpticFlowAlgorithm::Pyramid
+   void Pyramid(const Mat& image, vector<Mat>& pyramid) const {
+      if(this->tracker != nullptr) this->tracker->Pyramid(image, pyramid);
+      else pyramid.assign(1, image);
+   }
 
 };
 
@@ -0,0 +1,65 @@
+#ifndef AVR_GROUND_TRUTH_HPP
+#define AVR_GROUND_TRUTH_HPP
+
+#include <stdint.h>
+
+#include <avr/core/Core.hpp>
+
+#include "Marker.hpp"
+
+namespace avr {
+
+/**
+ * @struct GroundTruthRecord GroundTruth.hpp <avr/track/GroundTruth.hpp>
+ * @brief Known marker placement on a frame, it is written as is to the file
+ */
+struct GroundTruthRecord {
+   uint32_t frame;
+   uint32_t visible;       // all marker corners are inside the image
+   float    occlusion;     // fraction of the marker area covered by occluders
+   uint32_t reserved;      // keeps the doubles aligned
+   float    corners[8];    // (x, y) of the marker corners in the order of Marker::GetWorld
+   double   homography[9]; // marker image to frame, by row
+   double   pose[16];      // marker pose by row, in the convention of Camera::Pose (marker centered at the origin)
+
+   //! @return The corners as points
+   Coords2D Corners() const;
+};
+
+/**
+ * @class GroundTruth GroundTruth.hpp <avr/track/GroundTruth.hpp>
+ * @brief Ground truth of a synthetic sequence of a single marker, written by AVRSynth and read by the benchmark tools
+ *
+ * The file layout (little-endian) is:
+ *    @li header: magic "AVRGTRU", version, number of frames, marker size and frame size
+ *    @li one GroundTruthRecord per frame, in the frames order
+ */
+class GroundTruth {
+public:
+   //! Current file format version
+   static const uint32_t VERSION = 1;
+
+   GroundTruth() {/* ctor */}
+
+   //! Reads a ground truth file
+   static GroundTruth Read(const std::string& path);
+   //! Writes the ground truth to a new file
+   void Write(const std::string& path) const;
+
+   //! @return The mean distance in pixels between the given corners and the known ones, the order of Marker::GetWorld
+   static double CornerError(const GroundTruthRecord& truth, const Coords2D& corners);
+
+   size_t   Size() const { return this->records.size(); }
+   const GroundTruthRecord& operator [] (size_t i) const { return this->records[i]; }
+   void     Add(const GroundTruthRecord& rec) { this->records.push_back(rec); }
+
+   Size2i   markerSize;
+   Size2i   frameSize;
+
+private:
+   vector<GroundTruthRecord> records;
+};
+
+} // namespace avr
+
+#endif // AVR_GROUND_TRUTH_HPP
@@ -4,6 +4,10 @@
 #include <avr/core/Core.hpp>
 #include <avr/model/Model.hpp>
 
+#include "Algorithms.hpp"
+#include "MarkerFile.hpp"
+#include "Motion.hpp"
+
 namespace avr {
 
 using std::vector;
@@ -14,18 +18,40 @@ struct Frame {
    Mat image;
    Mat descriptor;
    Coords2D keys;
+   size_t number;    // sequence number given by the capture, it tags the trace spans of the frame
 
    Frame(const Mat& img, const Mat& descs, const Coords2D& pnts) :
-      image(img), descriptor(descs), keys(pnts) {/* ctor */}
+      image(img), descriptor(descs), keys(pnts), number(0), hasGray(false), hasPyramid(false) {/* ctor */}
 
-   Frame() {/* default */}
+   Frame() : number(0), hasGray(false), hasPyramid(false) {/* default */}
 
    Frame& operator = (const Frame& frm) {
       image = frm.image;
       descriptor = frm.descriptor;
       keys.assign(frm.keys.begin(), frm.keys.end());
+      number = frm.number;
+      gray = frm.gray;
+      pyramid = frm.pyramid;
+      hasGray = frm.hasGray;
+      hasPyramid = frm.hasPyramid;
       return * this;
    }
+
+   //! @return The grayscale image, it is converted only once per frame
+   const Mat& Gray() const;
+   //! @return The optical flow pyramid of the grayscale image, it is built only once per frame (see SystemAlgorithms::Pyramid)
+   const vector<Mat>& Pyramid(const SystemAlgorithms&) const;
+   //! Invalidates the cached images, the keypoints and the descriptors, it must be called when the image changes in place
+   //! @note The image buffers and the keypoints storage are kept to be filled again by the next frame
+   void Reset();
+
+private:
+   mutable Mat gray;
+   mutable vector<Mat> pyramid;
+   mutable bool hasGray;
+   mutable bool hasPyramid;
+
+   friend class FramePool;
 };
 
 struct Matches {
@@ -57,6 +83,12 @@ struct Matches {
       _error.clear();
    }
 
+   void reserve(size_t n) {
+      _targetPts.reserve(n);
+      _scenePts.reserve(n);
+      _error.reserve(n);
+   }
+
 private:
    Coords2D _targetPts;
    Coords2D _scenePts;
@@ -65,6 +97,25 @@ private:
    friend class HybridTracker;
 };
 
+/**
+ * @struct MarkerTrack Marker.hpp <avr/track/Marker.hpp>
+ * @brief Tracking state of a marker, each marker owns its own state so it can be found independently of the others
+ */
+struct MarkerTrack {
+   MarkerTrack() : lost(true), posed(false) {/* default */}
+
+   bool lost;              // mode: localization (lost) or optical flow tracking
+   Matches matches;        // matches on the last frame, their scene points are the previous points of the flow
+   TMatx pose;             // last estimated pose
+   bool posed;             // the pose was estimated at least once
+   MotionModel motion;     // motion of the last tracked frames, it seeds the optical flow
+
+   // scratch buffers reused on each frame
+   Coords2D flow;
+   vector<float> error;
+   vector<Mat> prevRegion, currRegion;   // pyramids of the marker's own flow region, when FindAll did not prepare one
+};
+
 struct PreMarker {
    PreMarker(const std::string& path, const SPtr<Model>& model) : path(path), model(model) {/* ctor */}
 
@@ -80,27 +131,41 @@ public:
 
    const Coords2D& GetWorld() const { return this->world; }
    SPtr<Model> GetModel() const     { return this->model; }
+   //! @return The scale of the model drawn on the marker, the model may be shared by other markers so it is not scaled itself
+   float GetModelScale() const      { return 0.60f * this->world[2].x; }
    size_t GetID() const             { return this->id; }
-   bool Lost() const                { return this->lost; }
-
-   void SetLost(bool lost) { this->lost = lost; }
+   bool Lost() const                { return this->track.lost; }
+   //! @return The matches found by the last HybridTracker::Find
+   const Matches& GetMatches() const { return this->track.matches; }
+   //! @return The tracking state of the marker
+   const MarkerTrack& GetTrack() const { return this->track; }
+
+   //! Sets the tracking mode, a lost marker forgets its motion
+   void SetLost(bool lost) { this->track.lost = lost; if(lost) this->track.motion.Reset(); }
+   //! Keeps the last estimated pose of the marker
+   void SetPose(const TMatx& pose) { this->track.pose = pose; this->track.posed = true; this->track.motion.Update(pose); }
+   //! Keeps the homography (marker image to frame) of the last frame, it predicts where the marker goes next
+   void SetHomography(const Matx33d& homography) { this->track.motion.Update(homography); }
 
 private:
-   Marker(const Size2i&, const Coords2D&, const cv::Mat&, const SPtr<Model>&);
+   Marker(const Size2i&, const Coords2D&, const cv::Mat&, const SPtr<MatchIndex>&, const SPtr<Model>&);
 
 private:
    size_t id;
-   bool lost;
    Coords2D world;
    Coords2D keys;
    cv::Mat descriptor;
+   SPtr<MatchIndex> index;   // descriptor prepared by the matcher at the registration
+   SPtr<MarkerFile> source;  // mapped database that owns the descriptor memory, if any
 
-   mutable Matches lastMatches;
+   mutable MarkerTrack track;
    mutable SPtr<Model> model;
 
    static size_t counter;
 
    friend class HybridTracker;
+   friend class MarkerDatabase;
+   friend class MarkerFile;
 };
 
 } // namespace avr
@@ -0,0 +1,67 @@
+#ifndef AVR_MARKER_FILE_HPP
+#define AVR_MARKER_FILE_HPP
+
+#include <stdint.h>
+
+#include <avr/core/Core.hpp>
+
+#include "Algorithms.hpp"
+
+namespace avr {
+
+class Marker;
+
+/**
+ * @class MarkerFile MarkerFile.hpp <avr/track/MarkerFile.hpp>
+ * @brief Binary marker database, it keeps the registration result of many markers to avoid detect and extract them on startup
+ *
+ * The file is memory-mapped in read-only mode, so the descriptors are used directly from the mapped pages without copying
+ * and several processes on the same host share the same physical memory. The file layout (little-endian) is:
+ *    @li header: magic "AVRMKDB", version, number of markers, algorithms hash, descriptor type, columns and row stride
+ *    @li one record per marker: image size, number of keypoints and offsets of its keypoints and descriptors
+ *    @li the keypoints of each marker as (x, y) float pairs, each block aligned to 64 bytes
+ *    @li the descriptor rows of all markers one after another, aligned to 32 bytes, so the descriptors of the whole file
+ *        are a single matrix (see MarkerDatabase)
+ *
+ * @note The algorithms hash depends on the configuration of the detector and the extractor (see FeatureDetector::Config
+ *    and DescriptorExtractor::Config), a file is only valid for the same detector and extractor configuration used to
+ *    write it. The keypoints budget does not change the marker features, so it is not part of the hash.
+ */
+class MarkerFile {
+public:
+   //! Current file format version
+   static const uint32_t VERSION = 2;
+
+   //! Maps a marker database file in read-only mode
+   static SPtr<MarkerFile> Open(const std::string& path);
+   //! Writes the markers to a new database file
+   static void Write(const std::string& path, const vector<Marker>& markers, const SystemAlgorithms& methods);
+   //! @return The configuration hash of the detector and extractor used by the algorithms
+   static uint64_t Hash(const SystemAlgorithms& methods);
+
+   ~MarkerFile();
+
+   //! @return The number of markers in the file
+   size_t   Size() const;
+   //! @return The algorithms configuration hash the file was written with
+   uint64_t GetHash() const;
+   //! @return The image size of the i-th marker
+   Size2i   GetSize(size_t i) const;
+   //! @return The keypoints of the i-th marker
+   vector<Point2f> GetKeys(size_t i) const;
+   //! @return The descriptors of the i-th marker, it points to the mapped memory and must not be modified
+   Mat      GetDescriptor(size_t i) const;
+
+private:
+   MarkerFile(const std::string& path);
+   MarkerFile(const MarkerFile&);
+   MarkerFile& operator = (const MarkerFile&);
+
+   const uchar* data;
+   size_t length;
+   void* handle;   // platform specific handle of the mapping
+};
+
+} // namespace avr
+
+#endif // AVR_MARKER_FILE_HPP
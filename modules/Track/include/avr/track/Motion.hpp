@@ -0,0 +1,52 @@
+#ifndef AVR_MOTION_HPP
+#define AVR_MOTION_HPP
+
+#include <avr/core/Core.hpp>
+
+namespace avr {
+
+//! Expected error of a constant velocity prediction, relative to the predicted motion of the points
+const float MOTION_UNCERTAINTY = 0.5f;
+//! Pixels added to the expected error of a prediction, the error of a small motion is not zero
+const float MOTION_MARGIN = 2.0f;
+
+/**
+ * @class MotionModel Motion.hpp <avr/track/Motion.hpp>
+ * @brief Constant velocity model of a tracked marker, it predicts the homography and the pose of the next frame
+ *
+ * The motion between the last two frames is assumed to repeat on the next one. The homographies and the poses must be
+ * given for consecutive frames, any gap (e.g. the marker was lost) must Reset the model.
+ */
+class MotionModel {
+public:
+   MotionModel() : homographies(0), poses(0) {/* ctor */}
+
+   //! Keeps the homography (marker image to frame) of a new frame
+   void Update(const Matx33d& homography);
+   //! Keeps the pose of a new frame
+   void Update(const TMatx& pose);
+   //! Forgets the past frames
+   void Reset() { this->homographies = this->poses = 0; }
+
+   //! @return true if there are homographies of two consecutive frames
+   bool Ready() const { return this->homographies >= 2; }
+   //! @return true if there are poses of two consecutive frames
+   bool Posed() const { return this->poses >= 2; }
+
+   //! @return The predicted motion of the frame points to the next frame, the identity if it is not ready
+   Matx33d Motion() const;
+   //! @return The predicted homography of the next frame @pre Ready()
+   Matx33d Predict() const;
+   //! @return The predicted pose of the next frame @pre Posed()
+   TMatx   PredictPose() const;
+
+private:
+   Matx33d lastHomography[2];   // the previous and the current one
+   TMatx   lastPose[2];
+   size_t  homographies;
+   size_t  poses;
+};
+
+} // namespace avr
+
+#endif // AVR_MOTION_HPP
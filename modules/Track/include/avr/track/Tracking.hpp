@@ -1,7 +1,13 @@
 #ifndef AVR_TRACKING_HPP
 #define AVR_TRACKING_HPP
 
+#include <map>
+#include <deque>
+#include <atomic>
+#include <future>
+
 #include <avr/core/Core.hpp>
+#include <avr/core/ThreadPool.hpp>
 
 #include "Algorithms.hpp"
 #include "Marker.hpp"
@@ -10,23 +16,269 @@ namespace avr {
 
 using std::vector;
 
+/**
+ * @class MarkerDatabase Tracking.hpp <avr/track/Tracking.hpp>
+ * @brief Joins the descriptors of all registered markers in a single prepared query
+ *
+ * When the matcher builds a search index, or all markers are lost, the scene descriptors are matched only once per frame
+ * against all markers, instead of once per lost marker, and the matches are dispatched to each marker by its ID (carried
+ * on DMatch::imgIdx). Otherwise a brute force query costs each of its rows, so only the lost markers are matched, each one
+ * with its own prepared descriptors.
+ * The markers of a mapped file are added in the order of the file, so their joint descriptors are a view of it.
+ */
+class MarkerDatabase {
+public:
+   MarkerDatabase() : index(nullptr) {/* ctor */}
+
+   //! Adds the descriptors of a marker, the joint index is prepared again on the next match
+   void Add(const Marker&);
+   //! @return true if the marker was added to the database
+   bool Contains(size_t id) const;
+   //! @return The number of markers in the database
+   size_t Size() const { return this->ids.size(); }
+
+   /**
+    * Matches the lost markers with the scene
+    * @param methods [in] Algorithms used to prepare the index and to match
+    * @param scene [in] Scene's descriptors
+    * @param lost [in] IDs of the markers to match, the others are not in the result
+    * @param matches [out] Matches of each marker ID, queryIdx refers to the marker's own keypoints
+    */
+   void Match(const SystemAlgorithms& methods, const Mat& scene, const vector<size_t>& lost,
+              std::map<size_t, vector<cv::DMatch> >& matches);
+   /**
+    * Keeps only the matches of each marker that agree with a homography found by RANSAC
+    * @param matches [inout] Matches of each marker ID, as given by Match
+    * @param scene [in] Scene's keypoints, referred by DMatch::trainIdx
+    * @param regions [out] Optional bounding rectangle of each marker projected by its homography
+    */
+   void Verify(std::map<size_t, vector<cv::DMatch> >& matches, const Coords2D& scene,
+               std::map<size_t, Rect2i>* regions = nullptr) const;
+
+private:
+   Mat descriptors;        // descriptors of all markers, one after another
+   SPtr<MarkerFile> mapped;   // file of the descriptors while they are a view of it
+   Coords2D keys;          // keypoints of all markers, in the same order of the descriptors
+   vector<int> offsets;    // first descriptor of each marker
+   vector<size_t> ids;     // ID of each marker
+   vector<Size2i> sizes;   // image size of each marker
+   vector<SPtr<MatchIndex> > indexes;   // prepared descriptors of each marker
+   SPtr<MatchIndex> index;
+};
+
+/**
+ * @class FrameHistory Tracking.hpp <avr/track/Tracking.hpp>
+ * @brief Ring of the last frames seen by the tracker
+ *
+ * The frames share their images, gray images and pyramids by reference counting, so keeping them costs no image copy.
+ * The age 0 is the current frame and the age 1 is the previous one for all markers.
+ */
+class FrameHistory {
+public:
+   explicit FrameHistory(size_t capacity = 4);
+
+   //! Keeps a new frame as the current one, the oldest frame is discarded when the ring is full
+   void Push(const Frame&);
+   //! Discards all frames
+   void Clear();
+
+   //! @return The frame kept age updates ago @pre age < Size()
+   const Frame& operator [] (size_t age) const;
+   //! @return The number of frames kept
+   size_t Size() const { return this->count; }
+   //! @return The maximum number of frames kept
+   size_t Capacity() const { return this->frames.size(); }
+
+private:
+   vector<Frame> frames;
+   size_t head;      // position of the current frame
+   size_t count;
+};
+
+/**
+ * @class FramePool Tracking.hpp <avr/track/Tracking.hpp>
+ * @brief Set of frames whose buffers are recycled, so a capture loop does not allocate them after the first frames
+ *
+ * A frame is given again only when no one else (e.g. the tracker's FrameHistory) refers its buffers, so the capture
+ * can write the new image in place. When all frames are in use the pool grows, it stops growing once it holds all the
+ * frames kept elsewhere.
+ */
+class FramePool {
+public:
+   /**
+    * @param size Initial number of frames
+    * @param keys Number of keypoints reserved in each frame
+    */
+   explicit FramePool(size_t size = 8, size_t keys = 2000);
+
+   //! @return A frame whose buffers are not shared, with its cache and keypoints reset
+   Frame& Acquire();
+   //! @return The number of frames in the pool
+   size_t Size() const { return this->frames.size(); }
+
+private:
+   std::deque<Frame> frames;   // the frames given are not moved when the pool grows
+   size_t next;
+   size_t keys;
+};
+
+/**
+ * @struct MarkerFeatures Tracking.hpp <avr/track/Tracking.hpp>
+ * @brief Detection and extraction result of a marker image, it is registered later by HybridTracker::Registry
+ */
+struct MarkerFeatures {
+   Size2i size;
+   Coords2D keys;
+   Mat descriptor;
+   SPtr<MatchIndex> index;
+};
+
+/**
+ * @struct SearchPolicy Tracking.hpp <avr/track/Tracking.hpp>
+ * @brief Where the lost markers are searched, so a localization does not always detect the whole frame at full resolution
+ *
+ * A marker lost for a few frames is searched only around its last position, in a window that widens with the lost frames.
+ * Otherwise a frame much wider than coarseWidth is first detected downscaled, and the markers found there are detected
+ * again at full resolution only inside their projected regions. When the coarse pass finds nothing, the next search
+ * is done on the whole frame at full resolution, so the small markers are still found.
+ */
+struct SearchPolicy {
+   SearchPolicy(int coarseWidth = 640, size_t recentFrames = 15, double growth = 0.5) :
+      coarseWidth(coarseWidth), recentFrames(recentFrames), growth(growth) {/* ctor */}
+
+   int coarseWidth;        // width of the downscaled frame of the coarse pass, 0 disables it
+   size_t recentFrames;    // a marker lost for up to this number of frames is searched around its last position
+   double growth;          // widening of the window per lost frame, relative to the larger side of the last region
+};
+
+/**
+ * @class HybridTracker Tracking.hpp <avr/track/Tracking.hpp>
+ * @brief Localizes the lost markers by their features and tracks the found ones by optical flow
+ *
+ * In the asynchronous mode the localization (detection, extraction, matching and verification) runs on a worker thread
+ * against a snapshot of a frame, so the found markers keep being tracked at the frame rate. When it finishes, its matches
+ * of the markers still lost are propagated by optical flow from the snapshot to the current frame through the frame history,
+ * only in regions around the matched points.
+ *
+ * The optical flow of a tracked marker runs only on a region around its points, so its cost follows the marker area
+ * instead of the frame area. FindAll merges the regions of the markers that overlap and pyramids each one only once.
+ */
 class HybridTracker {
 public:
-   explicit HybridTracker(const SystemAlgorithms& methods) : oneLost(true), methods(methods) {/* ctor */}
+   explicit HybridTracker(const SystemAlgorithms& methods) :
+      oneLost(true), async(false), sequence(0), coarseMissed(false), regionsCount(0), methods(methods) {/* ctor */}
+   //! Waits the pending localization
+   ~HybridTracker();
+
+   //! Enables the asynchronous localization, it must be set before the first frame
+   void SetAsync(bool enable);
+   bool IsAsync() const { return this->async; }
+   //! Sets where the lost markers are searched, it must be set before the first frame
+   void SetSearch(const SearchPolicy& policy) { this->search = policy; }
+   const SearchPolicy& GetSearch() const { return this->search; }
 
-   Matches  Find(const Marker&, const Frame&);
+   /**
+    * Finds a marker in the frame, the tracking state is kept by the marker itself
+    * @return The matches of the marker in the frame, they are valid until the next Find of the same marker
+    * @note After Update, Find may be called for different markers at the same time
+    */
+   const Matches& Find(const Marker&, const Frame&);
+   //! Finds all markers in the frame in parallel, the result of each one is given by Marker::GetMatches
+   void     FindAll(const vector<Marker>&, const Frame&);
 
-   Marker   Registry(const PreMarker&) const;
+   Marker   Registry(const PreMarker&);
+   /**
+    * Reads the marker image, detects and extracts its features and prepares its match index
+    * @note It does not change the tracker, so several markers can be prepared at the same time in different threads
+    */
+   MarkerFeatures Prepare(const std::string& path) const;
+   //! Registries a marker already prepared, it must not run concurrently with other registries
+   Marker   Registry(const MarkerFeatures&, const SPtr<Model>&);
+   //! Registries all markers of a mapped database file, they all share the same model
+   vector<Marker> Registry(const SPtr<MarkerFile>&, const SPtr<Model>&);
+   //! Prepares the tracker for a new frame, it must be called once per frame before any Find
    bool     Update(Frame& frm);
 
 private:
    // Methods to find marker in scene, Localize for lost mode and Track for tracking mode
-   bool Localize(const Marker&, const Frame&, Matches&);
-   bool Track(const Marker&, const Frame&, Matches&);
+   bool Localize(const Marker&, const Frame&, MarkerTrack&);
+   bool Track(const Marker&, const Frame&, MarkerTrack&);
 
-   Mat prevScene;
-   bool oneLost;
+   // region of the previous and the current frames pyramided for the markers tracked inside it
+   struct FlowRegion {
+      FlowRegion() : shared(false) {/* ctor */}
+      Rect2i rect;
+      vector<Mat> prev, curr;
+      bool shared;         // the pyramids are the frames' ones, they are never written
+   };
+   //! @return The region of the frame with the points of a tracked marker, their predicted positions and a border
+   static Rect2i Region(const MarkerTrack&, const Size2i& frame);
+   //! Builds the pyramids of the merged regions of the tracked markers, before they are tracked in parallel
+   void PrepareRegions(const vector<Marker>&);
+   //! Invalidates the regions, their buffers are kept but the shared pyramids are released
+   void ClearRegions();
+
+   // result of a localization
+   struct Relocalization {
+      size_t sequence;                                   // frame of the snapshot
+      Coords2D scene;                                    // keypoints of the snapshot
+      std::map<size_t, vector<cv::DMatch> > matches;    // verified matches of each marker
+   };
+   // matches of a marker found by a localization, propagated to the current frame
+   struct Relocated {
+      vector<cv::DMatch> matches;
+      Coords2D scene;                                    // current position of the scene keypoint of each match
+   };
+
+   // Asynchronous mode: starts a localization on a snapshot and takes the finished one
+   void Relocalize(const Frame&);
+   bool Reconcile();
+
+   // last place where a marker was found, the entries are created by the registry and only changed by Find
+   struct Sighting {
+      Sighting() : lost(true), seen(false), sequence(0) {/* ctor */}
+      bool lost;           // the last Find did not find it
+      bool seen;           // it was found at least once
+      size_t sequence;     // frame where it was last found
+      Rect2i region;       // bounding rectangle of its points on that frame
+   };
+   //! @return false if the whole frame must be searched, otherwise the windows around the recently lost markers
+   bool SearchWindows(const Size2i& frame, vector<Rect2i>& windows) const;
+   //! @return The IDs of the markers lost on their last Find, the ones matched by a localization
+   vector<size_t> LostMarkers() const;
+   //! Detects and extracts the features of a localization (see SearchPolicy), the keypoints are in frame coordinates and
+   //! the budget keeps at most its count of them over all the windows
+   void Features(const Mat& gray, vector<Rect2i> windows, bool whole, const vector<size_t>& lost,
+                 vector<cv::KeyPoint>& keys, Mat& descs);
+
+   HybridTracker(const HybridTracker&);
+   HybridTracker& operator = (const HybridTracker&);
+
+   FrameHistory history;   // last frames, the current one is kept by Update
+   std::atomic<bool> oneLost;
+
+   bool async;
+   size_t sequence;        // number of frames seen
+   SPtr<ThreadPool> worker;
+   std::future<Relocalization> job;
+   std::map<size_t, Relocated> relocated;   // propagated matches of each marker, taken by Localize
+
+   SearchPolicy search;
+   std::map<size_t, Sighting> sightings;
+   bool coarseMissed;      // the last coarse pass found no marker, only changed by the localization
+   vector<FlowRegion> regions;               // regions prepared by FindAll, kept to reuse their pyramids' buffers
+   size_t regionsCount;                      // number of regions of the current frame
+   vector<Rect2i> regionRects;
+   FlowRegion propagation;                   // region of the asynchronous propagation, moved with the relocated points
+
+   // scratch buffers reused on each frame by Update
+   vector<cv::KeyPoint> keypoints;
+   vector<Point2f> tracked;
+   vector<float> error;
    const SystemAlgorithms& methods;
+
+   MarkerDatabase database;
+   std::map<size_t, vector<cv::DMatch> > frameMatches;   // joint matches of the current frame
 };
 
 } // namespace avr
@@ -1,5 +1,9 @@
 #include <iostream>
 #include <time.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
 
 //#include <opencv2/nonfree/features2d.hpp>
 //#include <opencv2/video/tracking.hpp>   // optflow
@@ -14,6 +18,57 @@
 using namespace avr;
 using namespace std;
 
+// allocations of the whole program, with their bytes and the largest one
+static atomic<size_t> allocations(0);
+static atomic<size_t> allocatedBytes(0);
+static atomic<size_t> largestAllocation(0);
+
+static void counted(size_t size) {
+   allocations++;
+   allocatedBytes += size;
+   size_t largest = largestAllocation;
+   while(size > largest && !largestAllocation.compare_exchange_weak(largest, size));
+}
+
+#if defined(__GLIBC__)
+// the C allocator itself is interposed, so the buffers that OpenCV allocates (cv::fastMalloc) and operator new are counted
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+
+void* malloc(size_t size) {
+   counted(size);
+   return __libc_malloc(size);
+}
+void* calloc(size_t count, size_t size) {
+   counted(count * size);
+   return __libc_calloc(count, size);
+}
+void* realloc(void* p, size_t size) {
+   counted(size);
+   return __libc_realloc(p, size);
+}
+}
+#else
+// only the allocations of this program are seen, the C runtime of the OpenCV libraries cannot be interposed
+void* operator new(size_t size) {
+   counted(size);
+   if(void* p = malloc(size ? size : 1)) return p;
+   throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+   free(p);
+}
+#endif
+
+// frames before the steady-state allocation check
+const uint WARMUP_FRAMES = 30;
+// bytes, OpenCV's LK allocates its window scratch (cv::AutoBuffer) and the level lists on every call, they are below
+// this size, while any image, pyramid or keypoint buffer allocated again by the tracking loop is above it
+const size_t SCRATCH_LIMIT = 16 * 1024;
+
 int main() {
    cv::VideoCapture cap("../data/guitar_scene.mp4");
    if(!cap.isOpened()) {
@@ -21,27 +76,28 @@ int main() {
       return 1;
    }
 
-   //SystemAlgorithms algorithms(new SIFTDetector(500), new SIFTExtractor, new BruteForceMatcher(cv::NORM_L2), new LucasKanadeAlgorithm);
    SystemAlgorithms algorithms = SystemAlgorithms::Create(false, true);
-
    HybridTracker tracker(algorithms);
 
-   Marker target = tracker.Registry(PreMarker("../data/guitar_object.jpg", nullptr));
-   Size2i targetSize = target.GetSize();
-
-   vector<cv::Point2f> targetCorner(4);
-   targetCorner[0] = cv::Point2f(0.0, 0.0);
-   targetCorner[3] = cv::Point2f(0.0, targetSize.height);
-   targetCorner[2] = cv::Point2f(targetSize.width, targetSize.height);
-   targetCorner[1] = cv::Point2f(targetSize.width, 0.0);
+   // the loop runs through FindAll, as the application does, so the regions prepared for the flow are checked too
+   vector<Marker> markers(1, tracker.Registry(PreMarker("../data/guitar_object.jpg", nullptr)));
+   const Marker& target = markers[0];
 
    uint numFrames = 0;
    double time = (double) cv::getTickCount();
 
-   Frame frame;
-   Matches matches;
+   FramePool frames;
+   size_t poolSize = 0, steadyFrames = 0, steadyAllocations = 0, steadyBytes = 0, steadyLargest = 0;
 
    while(true) {
+      // every allocation of a tracked frame after the warm-up is counted, only the video decoder is left out
+      const bool steady = numFrames >= WARMUP_FRAMES && !target.Lost();
+      if(numFrames == WARMUP_FRAMES) poolSize = frames.Size();
+      largestAllocation = 0;
+      size_t count = allocations, bytes = allocatedBytes;
+
+      Frame& frame = frames.Acquire();
+      size_t acquired = allocations - count, acquiredBytes = allocatedBytes - bytes, acquiredLargest = largestAllocation;
       cap >> frame.image;
 
       if(frame.image.empty() and numFrames == 0) continue;
@@ -49,37 +105,28 @@ int main() {
 
       numFrames++;
 
+      largestAllocation = 0;
+      count = allocations; bytes = allocatedBytes;
       tracker.Update(frame);
-      matches = tracker.Find(target, frame);
-
-      if(matches.size() > 20) target.SetLost(false);
-      else target.SetLost(true);
-
-      if(matches.size() >= 4) {
-         vector<Point2f> corners;
-         Mat homography = cv::findHomography(matches.targetPts(), matches.scenePts(), cv::RANSAC, 4);
-         cv::perspectiveTransform(targetCorner, corners, homography);
-
-         if(!corners.empty()) {
-            cv::line(frame.image, corners[0], corners[1], cv::Scalar(0, 255, 0), 4);
-            cv::line(frame.image, corners[1], corners[2], cv::Scalar(0, 255, 0), 4);
-            cv::line(frame.image, corners[2], corners[3], cv::Scalar(0, 255, 0), 4);
-            cv::line(frame.image, corners[3], corners[0], cv::Scalar(0, 255, 0), 4);
-         }
-      }
-
-      for(auto p : matches.scenePts()) {
-         cv::circle(frame.image, p, 3, cv::Scalar(0, 255, 0), 1);
+      tracker.FindAll(markers, frame);
+      if(steady) {
+         steadyFrames++;
+         steadyAllocations += acquired + (allocations - count);
+         steadyBytes += acquiredBytes + (allocatedBytes - bytes);
+         steadyLargest = std::max<size_t>(steadyLargest, std::max<size_t>(acquiredLargest, largestAllocation));
       }
 
-      cv::imshow("Tracker Test", frame.image);
-      char key = cv::waitKey(1);
-      if(key == 0x1B) // ESC
-         break;
+      markers[0].SetLost(target.GetMatches().size() <= 20);
    }
 
    time = (double)(cv::getTickCount() - time) / cv::getTickFrequency();
    cout << (numFrames/time) << " fps\n";
 
+   cout << steadyAllocations << " allocations (" << steadyBytes << " bytes, the largest of " << steadyLargest << ") in "
+        << steadyFrames << " tracked frames after the warm-up, " << frames.Size() << " pooled frames\n";
+   if(steadyLargest >= SCRATCH_LIMIT || (poolSize > 0 && frames.Size() > poolSize)) {
+      cerr << "The steady-state tracking loop allocated a buffer or grew the frame pool\n";
+      return 2;
+   }
    return 0;
 }
@@ -1,9 +1,17 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/features2d/features2d.hpp> // ORB, BRISK, etc..
+#include <opencv2/flann/flann.hpp>           // search indices
 #include <opencv2/nonfree/features2d.hpp>    // SIFT and SURF
 #include <opencv2/video/tracking.hpp>        // optflow
 
 #include <avr/track/Algorithms.hpp>
+#include <avr/core/Profiler.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <typeinfo>
+#include <limits>
+#include <cmath>
 
 #ifndef NULL
    #define NULL 0x0
@@ -16,107 +24,578 @@ namespace avr {
 *                                                  Feature Detectors                                                           *
 \*----------------------------------------------------------------------------------------------------------------------------*/
 
+std::string FeatureDetector::Config() const {
+   return typeid(*this).name();
+}
+
+BRISKDetector::BRISKDetector(int _threshold, int _nOctaves, float _patternScale) : FeatureDetector(),
+   threshold(_threshold), nOctaves(_nOctaves), patternScale(_patternScale),
+   engine(new cv::BRISK(_threshold, _nOctaves, _patternScale)) {/* ctor */}
+
+BRISKDetector::~BRISKDetector() {/* dtor */}
+
 void BRISKDetector::operator() (const Mat& image, vector<cv::KeyPoint>& keys) const {
-   cv::BRISK detector(this->threshold, this->nOctaves, this->patternScale);
-   detector.detect(image, keys);
+   this->engine->detect(image, keys);
 }
 
+std::string BRISKDetector::Config() const {
+   std::ostringstream out;
+   out << "BRISK(" << this->threshold << "," << this->nOctaves << ")";
+   return out.str();
+}
+
+FASTDetector::FASTDetector(int _threshold, bool _nonmaxSuppression) : FeatureDetector(),
+   threshold(_threshold), nonmaxSuppression(_nonmaxSuppression),
+   engine(new cv::FastFeatureDetector(_threshold, _nonmaxSuppression)) {/* ctor */}
+
+FASTDetector::~FASTDetector() {/* dtor */}
+
 void FASTDetector::operator() (const Mat& image, vector<cv::KeyPoint>& keys) const {
-   cv::FastFeatureDetector detector(this->threshold, this->nonmaxSuppression);
-   detector.detect(image, keys);
+   this->engine->detect(image, keys);
+}
+
+std::string FASTDetector::Config() const {
+   std::ostringstream out;
+   out << "FAST(" << this->threshold << "," << this->nonmaxSuppression << ")";
+   return out.str();
 }
 
+ORBDetector::ORBDetector(int _nfeatures, float _scaleFactor, int _nlevels, int _edgeThreshold) : FeatureDetector(),
+   nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels), edgeThreshold(_edgeThreshold),
+   engine(new cv::OrbFeatureDetector(_nfeatures, _scaleFactor, _nlevels, _edgeThreshold)) {/* ctor */}
+
+ORBDetector::~ORBDetector() {/* dtor */}
+
 void ORBDetector::operator() (const Mat& image, vector<cv::KeyPoint>& keys) const {
-   cv::OrbFeatureDetector detector(this->nfeatures, this->scaleFactor, this->nlevels, this->edgeThreshold);
-   detector.detect(image, keys);
+   this->engine->detect(image, keys);
+}
+
+std::string ORBDetector::Config() const {
+   std::ostringstream out;
+   out << "ORB(" << this->nfeatures << "," << this->scaleFactor << "," << this->nlevels << "," << this->edgeThreshold << ")";
+   return out.str();
 }
 
+STARDetector::STARDetector(int _maxSize, int _responseThreshold, int _lineThresholdProjected, int _lineThresholdBinarized) : FeatureDetector(),
+   maxSize(_maxSize), responseThreshold(_responseThreshold), lineThresholdProjected(_lineThresholdProjected),
+   lineThresholdBinarized(_lineThresholdBinarized),
+   engine(new cv::StarFeatureDetector(_maxSize, _responseThreshold, _lineThresholdProjected, _lineThresholdBinarized)) {/* ctor */}
+
+STARDetector::~STARDetector() {/* dtor */}
+
 void STARDetector::operator() (const Mat& image, vector<cv::KeyPoint>& keys) const {
-   cv::StarFeatureDetector detector(this->maxSize, this->responseThreshold, this->lineThresholdProjected, this->lineThresholdBinarized);
-   detector.detect(image, keys);
+   this->engine->detect(image, keys);
 }
 
+std::string STARDetector::Config() const {
+   std::ostringstream out;
+   out << "STAR(" << this->maxSize << "," << this->responseThreshold << "," << this->lineThresholdProjected << ","
+       << this->lineThresholdBinarized << ")";
+   return out.str();
+}
+
+SIFTDetector::SIFTDetector(int _nfeatures, int _nOctaveLayers, double _contrastTh, double _edgeTh, double _sigma) : FeatureDetector(),
+   nfeatures(_nfeatures), nOctaveLayers(_nOctaveLayers), contrastThreshold(_contrastTh), edgeThreshold(_edgeTh), sigma(_sigma),
+   engine(new cv::SiftFeatureDetector(_nfeatures, _nOctaveLayers, _contrastTh, _edgeTh, _sigma)) {/* ctor */}
+
+SIFTDetector::~SIFTDetector() {/* dtor */}
+
 void SIFTDetector::operator() (const Mat& image, vector<cv::KeyPoint>& keys) const {
-   cv::SiftFeatureDetector detector(this->nfeatures, this->nOctaveLayers, this->contrastThreshold, this->edgeThreshold, this->sigma);
-   detector.detect(image, keys);
+   this->engine->detect(image, keys);
+}
+
+std::string SIFTDetector::Config() const {
+   std::ostringstream out;
+   out << "SIFT(" << this->nfeatures << "," << this->nOctaveLayers << "," << this->contrastThreshold << "," << this->edgeThreshold << ","
+       << this->sigma << ")";
+   return out.str();
 }
 
+SURFDetector::SURFDetector(double _hessianThreshold, int _nOctaves, int _nOctaveLayers) : FeatureDetector(),
+   hessianThreshold(_hessianThreshold), nOctaves(_nOctaves), nOctaveLayers(_nOctaveLayers),
+   engine(new cv::SurfFeatureDetector(_hessianThreshold, _nOctaves, _nOctaveLayers)) {/* ctor */}
+
+SURFDetector::~SURFDetector() {/* dtor */}
+
 void SURFDetector::operator() (const Mat& image, vector<cv::KeyPoint>& keys) const {
-   cv::SurfFeatureDetector detector(this->hessianThreshold, this->nOctaves, this->nOctaveLayers);
-   detector.detect(image, keys);
+   this->engine->detect(image, keys);
+}
+
+std::string SURFDetector::Config() const {
+   std::ostringstream out;
+   out << "SURF(" << this->hessianThreshold << "," << this->nOctaves << "," << this->nOctaveLayers << ")";
+   return out.str();
+}
+
+TiledDetector::TiledDetector(const SPtr<FeatureDetector>& _detector, int _cols, int _rows, size_t _perCell, int _overlap, size_t _threads)
+   : FeatureDetector(), detector(_detector), cols(std::max(_cols, 1)), rows(std::max(_rows, 1)), perCell(_perCell),
+     overlap(std::max(_overlap, 0)), pool(new ThreadPool(_threads)) {
+   AVR_ASSERT(!this->detector.Null());
+}
+
+TiledDetector::~TiledDetector() {/* dtor */}
+
+namespace {
+
+inline bool stronger(const cv::KeyPoint& a, const cv::KeyPoint& b) {
+   return a.response > b.response;
+}
+
+} // namespace
+
+void TiledDetector::operator() (const Mat& image, vector<cv::KeyPoint>& keys) const {
+   keys.clear();
+   if(image.empty()) return;
+
+   const int cellW = (image.cols + this->cols - 1) / this->cols;
+   const int cellH = (image.rows + this->rows - 1) / this->rows;
+   const Rect2i whole(0, 0, image.cols, image.rows);
+
+   // the tiles run in parallel, each one writes only its own keypoints
+   const size_t count = size_t(this->cols * this->rows);
+   vector<vector<cv::KeyPoint> > found(count);
+   vector<std::future<void> > jobs;
+   jobs.reserve(count);
+   for(size_t t = 0; t < count; t++) {
+      const Rect2i cell = Rect2i(int(t % this->cols) * cellW, int(t / this->cols) * cellH, cellW, cellH) & whole;
+      Rect2i tile(cell.x - this->overlap, cell.y - this->overlap, cell.width + 2*this->overlap, cell.height + 2*this->overlap);
+      tile &= whole;
+      if(tile.area() == 0) continue;
+
+      Mat crop = image(tile);
+      vector<cv::KeyPoint>* out = &found[t];
+      const FeatureDetector* engine = &(*this->detector);
+      const size_t perCell = this->perCell;
+      jobs.push_back(this->pool->Submit([engine, crop, out, tile, cell, perCell]() {
+         (*engine)(crop, *out);
+         // the overlap is only the context of the detector: a tile keeps the keypoints of its own cell, so a feature
+         // found by two tiles is kept once whatever the response each crop gives it
+         const Point2f origin(tile.x, tile.y);
+         size_t n = 0;
+         for(auto& k : *out) {
+            k.pt += origin;
+            if(k.pt.x >= cell.x && k.pt.y >= cell.y && k.pt.x < cell.x + cell.width && k.pt.y < cell.y + cell.height)
+               (*out)[n++] = k;
+         }
+         out->resize(n);
+
+         // each cell keeps its strongest keypoints
+         if(perCell > 0 && out->size() > perCell) {
+            std::nth_element(out->begin(), out->begin() + perCell, out->end(), stronger);
+            out->resize(perCell);
+         }
+      }));
+   }
+   for(auto& job : jobs)
+      job.get();
+
+   for(const auto& cell : found)
+      keys.insert(keys.end(), cell.begin(), cell.end());
+}
+
+std::string TiledDetector::Config() const {
+   std::ostringstream out;
+   out << "Tiled(" << this->cols << "," << this->rows << "," << this->perCell << "," << this->overlap << ")["
+       << this->detector->Config() << "]";
+   return out.str();
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------*\
 *                                                Descriptor Extractors                                                         *
 \*----------------------------------------------------------------------------------------------------------------------------*/
 
+namespace {
+
+// descriptor type and columns of an extractor, the part of its configuration that the matchers depend on
+std::string format(const cv::DescriptorExtractor& engine) {
+   std::ostringstream out;
+   out << ":" << engine.descriptorType() << "x" << engine.descriptorSize();
+   return out.str();
+}
+
+} // namespace
+
+std::string DescriptorExtractor::Config() const {
+   return typeid(*this).name();
+}
+
+BRIEFExtractor::BRIEFExtractor(int _bytes) : DescriptorExtractor(),
+   bytes(_bytes), engine(new cv::BriefDescriptorExtractor(_bytes)) {/* ctor */}
+
+BRIEFExtractor::~BRIEFExtractor() {/* dtor */}
+
 void BRIEFExtractor::operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const {
-   cv::BriefDescriptorExtractor extractor(this->bytes);
-   extractor.compute(image, keys, out);
+   this->engine->compute(image, keys, out);
+}
+
+std::string BRIEFExtractor::Config() const {
+   std::ostringstream out;
+   out << "BRIEF(" << this->bytes << ")" << format(*this->engine);
+   return out.str();
 }
 
+// the sampling pattern tables of BRISK are generated here only once
+BRISKExtractor::BRISKExtractor(float _patternScale) : DescriptorExtractor(),
+   patternScale(_patternScale), engine(new cv::BRISK(30, 3, _patternScale)) {/* ctor */}
+
+BRISKExtractor::~BRISKExtractor() {/* dtor */}
+
 void BRISKExtractor::operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const {
-   cv::BRISK extractor(30, 3, this->patternScale);
-   extractor.compute(image, keys, out);
+   this->engine->compute(image, keys, out);
+}
+
+std::string BRISKExtractor::Config() const {
+   std::ostringstream out;
+   out << "BRISK(" << this->patternScale << ")" << format(*this->engine);
+   return out.str();
 }
 
+ORBExtractor::ORBExtractor(int _WTA_K, int _patchSize) : DescriptorExtractor(),
+   WTA_K(_WTA_K), patchSize(_patchSize),
+   engine(new cv::OrbDescriptorExtractor(500, 1.2f, 8, 31, 0, _WTA_K, cv::ORB::HARRIS_SCORE, _patchSize)) {/* ctor */}
+
+ORBExtractor::~ORBExtractor() {/* dtor */}
+
 void ORBExtractor::operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const {
-   cv::OrbDescriptorExtractor extractor(500, 1.2f, 8, 31, 0, this->WTA_K, cv::ORB::HARRIS_SCORE, this->patchSize);
-   extractor.compute(image, keys, out);
+   this->engine->compute(image, keys, out);
 }
 
+std::string ORBExtractor::Config() const {
+   std::ostringstream out;
+   out << "ORB(" << this->WTA_K << "," << this->patchSize << ")" << format(*this->engine);
+   return out.str();
+}
+
+SIFTExtractor::SIFTExtractor() : DescriptorExtractor(),
+   engine(new cv::SiftDescriptorExtractor) {/* ctor */}
+
+SIFTExtractor::~SIFTExtractor() {/* dtor */}
+
 void SIFTExtractor::operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const {
-   cv::SiftDescriptorExtractor extractor;
-   extractor.compute(image, keys, out);
+   this->engine->compute(image, keys, out);
+}
+
+std::string SIFTExtractor::Config() const {
+   std::ostringstream out;
+   out << "SIFT" << format(*this->engine);
+   return out.str();
 }
 
+SURFExtractor::SURFExtractor(bool _extended) : DescriptorExtractor(),
+   extended(_extended), engine(new cv::SurfDescriptorExtractor(400.0, 4, 2, _extended, false)) {/* ctor */}
+
+SURFExtractor::~SURFExtractor() {/* dtor */}
+
 void SURFExtractor::operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const {
-   cv::SurfDescriptorExtractor extractor(400.0, 4, 2, this->extended, false);
-   extractor.compute(image, keys, out);
+   this->engine->compute(image, keys, out);
+}
+
+std::string SURFExtractor::Config() const {
+   std::ostringstream out;
+   out << "SURF(" << this->extended << ")" << format(*this->engine);
+   return out.str();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Feature Engines                                                            *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+SPtr<FeatureEngine> FeatureEngine::Fuse(const SPtr<FeatureDetector>& detector, const SPtr<DescriptorExtractor>& extractor) {
+   if(detector == nullptr || extractor == nullptr) return SPtr<FeatureEngine>();
+   const FeatureDetector* det = &(*detector);
+   const DescriptorExtractor* ext = &(*extractor);
+
+   // the detector gives the scale space, the extractor only the parameters of the descriptor
+   if(const SIFTDetector* sift = dynamic_cast<const SIFTDetector*>(det)) {
+      if(dynamic_cast<const SIFTExtractor*>(ext) != NULL)
+         return new SIFTEngine(sift->nfeatures, sift->nOctaveLayers, sift->contrastThreshold, sift->edgeThreshold, sift->sigma);
+   } else if(const SURFDetector* surf = dynamic_cast<const SURFDetector*>(det)) {
+      if(const SURFExtractor* surfExt = dynamic_cast<const SURFExtractor*>(ext))
+         return new SURFEngine(surf->hessianThreshold, surf->nOctaves, surf->nOctaveLayers, surfExt->extended);
+   } else if(const ORBDetector* orb = dynamic_cast<const ORBDetector*>(det)) {
+      if(const ORBExtractor* orbExt = dynamic_cast<const ORBExtractor*>(ext))
+         return new ORBEngine(orb->nfeatures, orb->scaleFactor, orb->nlevels, orb->edgeThreshold, orbExt->WTA_K, orbExt->patchSize);
+   } else if(const BRISKDetector* brisk = dynamic_cast<const BRISKDetector*>(det)) {
+      if(const BRISKExtractor* briskExt = dynamic_cast<const BRISKExtractor*>(ext))
+         return new BRISKEngine(brisk->threshold, brisk->nOctaves, briskExt->patternScale);
+   }
+   return SPtr<FeatureEngine>();
+}
+
+BRISKEngine::BRISKEngine(int _threshold, int _nOctaves, float _patternScale) : FeatureEngine(),
+   engine(new cv::BRISK(_threshold, _nOctaves, _patternScale)) {/* ctor */}
+
+BRISKEngine::~BRISKEngine() {/* dtor */}
+
+void BRISKEngine::operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const {
+   (*this->engine)(image, cv::noArray(), keys, out);
+}
+
+ORBEngine::ORBEngine(int _nfeatures, float _scaleFactor, int _nlevels, int _edgeThreshold, int _WTA_K, int _patchSize) : FeatureEngine(),
+   engine(new cv::ORB(_nfeatures, _scaleFactor, _nlevels, _edgeThreshold, 0, _WTA_K, cv::ORB::HARRIS_SCORE, _patchSize)) {/* ctor */}
+
+ORBEngine::~ORBEngine() {/* dtor */}
+
+void ORBEngine::operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const {
+   (*this->engine)(image, cv::noArray(), keys, out);
+}
+
+SIFTEngine::SIFTEngine(int _nfeatures, int _nOctaveLayers, double _contrastTh, double _edgeTh, double _sigma) : FeatureEngine(),
+   engine(new cv::SIFT(_nfeatures, _nOctaveLayers, _contrastTh, _edgeTh, _sigma)) {/* ctor */}
+
+SIFTEngine::~SIFTEngine() {/* dtor */}
+
+void SIFTEngine::operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const {
+   (*this->engine)(image, cv::noArray(), keys, out);
+}
+
+SURFEngine::SURFEngine(double _hessianThreshold, int _nOctaves, int _nOctaveLayers, bool _extended) : FeatureEngine(),
+   engine(new cv::SURF(_hessianThreshold, _nOctaves, _nOctaveLayers, _extended, false)) {/* ctor */}
+
+SURFEngine::~SURFEngine() {/* dtor */}
+
+void SURFEngine::operator() (const Mat& image, vector<cv::KeyPoint>& keys, Mat& out) const {
+   (*this->engine)(image, cv::noArray(), keys, out);
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------*\
 *                                                 Descriptor Matchers                                                          *
 \*----------------------------------------------------------------------------------------------------------------------------*/
 
+BruteForceMatcher::BruteForceMatcher(int _normType, bool _crossCheck) : DescriptorMatcher(),
+   normType(_normType), crossCheck(_crossCheck), engine(new cv::BFMatcher(_normType, _crossCheck)) {/* ctor */}
+
+BruteForceMatcher::~BruteForceMatcher() {/* dtor */}
+
 void BruteForceMatcher::operator() (const Mat& query, const Mat& train, vector<cv::DMatch>& goodMatches) const {
-   cv::BFMatcher matcher(this->normType, this->crossCheck);
    vector<vector<cv::DMatch> > matches;
    register bool ccheck = this->crossCheck;
 
-   matcher.knnMatch(query, train, matches, ccheck ? 1 : 2);
-   for(auto it : matches)
+   // the const overload does not touch the engine's train collection, so it is safe to share it
+   this->engine->knnMatch(query, train, matches, ccheck ? 1 : 2);
+   for(auto& it : matches)
       if(ccheck || it[0].distance < 0.7 * it[1].distance)
          goodMatches.push_back(it[0]);
 }
 
+FlannBasedMatcher::FlannBasedMatcher() : DescriptorMatcher(),
+   engine(new cv::FlannBasedMatcher) {/* ctor */}
+
+FlannBasedMatcher::~FlannBasedMatcher() {/* dtor */}
+
 void FlannBasedMatcher::operator() (const Mat& query, const Mat& train, vector<cv::DMatch>& goodMatches) const {
-   cv::FlannBasedMatcher matcher;
    vector<vector<cv::DMatch> > matches;
 
-   matcher.knnMatch(query, train, matches, 2);
-   for(auto it : matches)
+   this->engine->knnMatch(query, train, matches, 2);
+   for(auto& it : matches)
       if(it[0].distance < 0.7 * it[1].distance)
          goodMatches.push_back(it[0]);
 }
 
+namespace {
+
+//! Query descriptors with a search index built over them
+class FlannIndex : public MatchIndex {
+public:
+   explicit FlannIndex(const Mat& descriptors) : MatchIndex(descriptors), binary(descriptors.type() == CV_8U), search(nullptr) {
+      if(this->binary)
+         this->search = new cv::flann::Index(descriptors, cv::flann::LshIndexParams(12, 20, 2), cvflann::FLANN_DIST_HAMMING);
+      else
+         this->search = new cv::flann::Index(descriptors, cv::flann::KDTreeIndexParams(4), cvflann::FLANN_DIST_L2);
+   }
+
+   bool binary;
+   mutable SPtr<cv::flann::Index> search;
+};
+
+} // namespace
+
+void FlannBasedMatcher::operator() (const MatchIndex& query, const Mat& train, vector<cv::DMatch>& goodMatches) const {
+   const FlannIndex* index = dynamic_cast<const FlannIndex*>(&query);
+   if(index == NULL || train.empty()) {
+      (*this)(query.descriptors, train, goodMatches);
+      return;
+   }
+
+   Mat indices, dists;
+   int knn = std::min(2, query.descriptors.rows);
+   index->search->knnSearch(train, indices, dists, knn, index->binary ? cv::flann::SearchParams() : cv::flann::SearchParams(32));
+   dists.convertTo(dists, CV_32F);
+
+   // k-d forest returns squared L2 distances
+   const float ratio = index->binary ? 0.7f : 0.49f;
+   for(int i = 0; i < train.rows; i++) {
+      const int* idx = indices.ptr<int>(i);
+      const float* dist = dists.ptr<float>(i);
+      if(idx[0] < 0) continue;
+      if(knn < 2 || idx[1] < 0 || dist[0] < ratio * dist[1])
+         goodMatches.push_back(cv::DMatch(idx[0], i, index->binary ? dist[0] : std::sqrt(dist[0])));
+   }
+}
+
+SPtr<MatchIndex> FlannBasedMatcher::Index(const Mat& query) const {
+   if(query.empty() || (query.type() != CV_8U && query.type() != CV_32F))
+      return new MatchIndex(query);
+   return new FlannIndex(query);
+}
+
 /*----------------------------------------------------------------------------------------------------------------------------*\
 *                                                     Optical Flow                                                             *
 \*----------------------------------------------------------------------------------------------------------------------------*/
 
+namespace {
+
+const cv::Size LK_WINDOW(31, 31);
+const int      LK_LEVELS = 3;
+
+} // namespace
+
 void LucasKanadeAlgorithm::operator() (const Mat& prevImage, const vector<Point2f>& prevTracked,
                                        const Mat& currImage, vector<Point2f>& tracked,
                                        vector<float>& error) const
 {
    vector<unsigned char> status; vector<float> err;
    cv::calcOpticalFlowPyrLK(prevImage, currImage, prevTracked, tracked, status, err,
-                            cv::Size(31,31), 3, cv::TermCriteria(3, 20, 0.03), 0, 1e-3);
+                            LK_WINDOW, LK_LEVELS, cv::TermCriteria(3, 20, 0.03), 0, 1e-3);
 
    for(size_t i = 0; i < status.size(); i++) {
       error.push_back( status[i] ? err[i] : -1.0f );
    }
 }
 
+void LucasKanadeAlgorithm::operator() (const vector<Mat>& prevPyramid, const vector<Point2f>& prevTracked,
+                                       const vector<Mat>& currPyramid, vector<Point2f>& tracked,
+                                       vector<float>& error) const
+{
+   // the outputs are written in place, so the buffers of the caller and of each thread are reused every frame
+   static thread_local vector<unsigned char> status;
+   cv::calcOpticalFlowPyrLK(prevPyramid, currPyramid, prevTracked, tracked, status, error,
+                            LK_WINDOW, LK_LEVELS, cv::TermCriteria(3, 20, 0.03), 0, 1e-3);
+
+   for(size_t i = 0; i < status.size(); i++) {
+      if(!status[i]) error[i] = -1.0f;
+   }
+}
+
+void LucasKanadeAlgorithm::operator() (const vector<Mat>& prevPyramid, const vector<Point2f>& prevTracked,
+                                       const vector<Mat>& currPyramid, vector<Point2f>& tracked,
+                                       vector<float>& error, float motion) const
+{
+   // each level doubles the distance covered by the window, the coarse levels are skipped when the guess is close
+   int levels = 1;
+   while(levels < LK_LEVELS && (LK_WINDOW.width / 2) * (1 << levels) < motion)
+      levels++;
+
+   static thread_local vector<unsigned char> status;
+   cv::calcOpticalFlowPyrLK(prevPyramid, currPyramid, prevTracked, tracked, status, error,
+                            LK_WINDOW, levels, cv::TermCriteria(3, 20, 0.03), cv::OPTFLOW_USE_INITIAL_FLOW, 1e-3);
+
+   for(size_t i = 0; i < status.size(); i++) {
+      if(!status[i]) error[i] = -1.0f;
+   }
+}
+
+void LucasKanadeAlgorithm::Pyramid(const Mat& image, vector<Mat>& pyramid) const {
+   // the first level of a region is copied instead of being a view of the frame, so the buffers of the pyramid are
+   // its own: they are rebuilt in place for the same size and they never write into (or keep alive) the frame
+   cv::buildOpticalFlowPyramid(image, pyramid, LK_WINDOW, LK_LEVELS, true, cv::BORDER_REFLECT_101, cv::BORDER_CONSTANT, false);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Keypoints Budget                                                           *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+namespace {
+
+const float  ANMS_ROBUSTNESS = 0.9f;   // a keypoint suppresses another one only if it is clearly stronger
+const size_t ANMS_CANDIDATES = 8;      // budgets of the strongest keypoints given to the quadratic suppression
+
+// strongest n keypoints, not sorted
+void strongest(vector<cv::KeyPoint>& keys, size_t n) {
+   if(keys.size() <= n) return;
+   std::nth_element(keys.begin(), keys.begin() + n, keys.end(), stronger);
+   keys.resize(n);
+}
+
+void anms(vector<cv::KeyPoint>& keys, size_t n) {
+   // the weakest keypoints would only be kept in empty regions, they are left out to bound the cost
+   strongest(keys, ANMS_CANDIDATES * n);
+   std::sort(keys.begin(), keys.end(), stronger);
+
+   // suppression radius of each keypoint: distance to the nearest clearly stronger one
+   vector<std::pair<float, size_t> > radius(keys.size());
+   for(size_t i = 0; i < keys.size(); i++) {
+      float r2 = std::numeric_limits<float>::max();
+      for(size_t j = 0; j < i && keys[i].response < ANMS_ROBUSTNESS * keys[j].response; j++) {
+         Point2f d = keys[i].pt - keys[j].pt;
+         r2 = std::min(r2, d.x*d.x + d.y*d.y);
+      }
+      radius[i] = std::make_pair(-r2, i);
+   }
+   // the widest radii first
+   std::nth_element(radius.begin(), radius.begin() + n, radius.end());
+   vector<cv::KeyPoint> kept(n);
+   for(size_t i = 0; i < n; i++)
+      kept[i] = keys[radius[i].second];
+   keys.swap(kept);
+}
+
+void grid(vector<cv::KeyPoint>& keys, size_t n, const Size2i& image, int cols, int rows) {
+   cols = std::max(cols, 1); rows = std::max(rows, 1);
+   const size_t quota = (n + cols * rows - 1) / (cols * rows);
+   const float cellW = float(image.width) / cols, cellH = float(image.height) / rows;
+
+   vector<vector<cv::KeyPoint> > cells(cols * rows);
+   for(const auto& k : keys) {
+      int cx = std::min(std::max(int(k.pt.x / cellW), 0), cols - 1);
+      int cy = std::min(std::max(int(k.pt.y / cellH), 0), rows - 1);
+      cells[cy * cols + cx].push_back(k);
+   }
+   // each cell gives its quota, the quota left by the poor cells goes to the strongest keypoints left
+   vector<cv::KeyPoint> kept, left;
+   for(auto& cell : cells) {
+      if(cell.size() > quota) {
+         std::nth_element(cell.begin(), cell.begin() + quota, cell.end(), stronger);
+         left.insert(left.end(), cell.begin() + quota, cell.end());
+         cell.resize(quota);
+      }
+      kept.insert(kept.end(), cell.begin(), cell.end());
+   }
+   if(kept.size() < n) {
+      strongest(left, n - kept.size());
+      kept.insert(kept.end(), left.begin(), left.end());
+   }
+   strongest(kept, n);
+   keys.swap(kept);
+}
+
+} // namespace
+
+void KeypointBudget::Apply(const Size2i& image, vector<cv::KeyPoint>& keys) const {
+   if(!this->Active() || keys.size() <= this->count) return;
+   AVR_PROFILE_COUNT("budget.culled", keys.size() - this->count);
+
+   switch(this->policy) {
+   case RESPONSE: {
+      AVR_PROFILE_SCOPE("budget.response");
+      strongest(keys, this->count);
+      break;
+   }
+   case ANMS: {
+      AVR_PROFILE_SCOPE("budget.anms");
+      anms(keys, this->count);
+      break;
+   }
+   case GRID: {
+      AVR_PROFILE_SCOPE("budget.grid");
+      grid(keys, this->count, image, this->cols, this->rows);
+      break;
+   }
+   default:
+      break;
+   }
+}
+
 /*----------------------------------------------------------------------------------------------------------------------------*\
 *                                                           System                                                             *
 \*----------------------------------------------------------------------------------------------------------------------------*/
@@ -131,15 +610,15 @@ SystemAlgorithms SystemAlgorithms::Create(bool optimazePerformance, bool optimaz
    if(!optimazePerformance xor optimazeQuality) {
       detector = new SIFTDetector(500);
       extractor = new BRISKExtractor;
-      matcher = new BruteForceMatcher(cv::NORM_HAMMING);
+      matcher = new HammingMatcher;
    } else if(optimazePerformance) {
       detector = new STARDetector;
       extractor = new SURFExtractor;
-      matcher = new BruteForceMatcher(cv::NORM_L1);
+      matcher = new FloatMatcher(cv::NORM_L1);
    } else { // optimazeQuality
       detector = new SIFTDetector;
       extractor = new SIFTExtractor;
-      matcher = new BruteForceMatcher(cv::NORM_L2);
+      matcher = new FloatMatcher(cv::NORM_L2);
    }
 
    return SystemAlgorithms(detector, extractor, matcher, tracker);
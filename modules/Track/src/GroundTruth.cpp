@@ -0,0 +1,89 @@
+#include <opencv2/core/core.hpp>
+
+#include <avr/track/GroundTruth.hpp>
+
+#include <fstream>
+#include <cstring>
+#include <cmath>
+
+namespace avr {
+
+namespace {
+
+const char MAGIC[8] = "AVRGTRU";
+
+struct FileHeader {
+   char     magic[8];
+   uint32_t version;
+   uint32_t count;
+   int32_t  markerWidth;
+   int32_t  markerHeight;
+   int32_t  frameWidth;
+   int32_t  frameHeight;
+};
+
+} // namespace
+
+Coords2D GroundTruthRecord::Corners() const {
+   Coords2D out(4);
+   for(size_t k = 0; k < 4; k++)
+      out[k] = Point2f(this->corners[2*k], this->corners[2*k + 1]);
+   return out;
+}
+
+GroundTruth GroundTruth::Read(const std::string& path) {
+   std::ifstream in(path.c_str(), std::ios::binary);
+   if(!in.is_open())
+      AVR_FMT_ERROR(Cod::Undefined, "It did not open the ground truth file %s", path.c_str());
+
+   FileHeader head;
+   in.read(reinterpret_cast<char*>(&head), sizeof(head));
+   if(!in.good() || std::memcmp(head.magic, MAGIC, sizeof(MAGIC)) != 0)
+      AVR_FMT_ERROR(Cod::Undefined, "The file %s is not a ground truth file", path.c_str());
+   if(head.version != VERSION)
+      AVR_FMT_ERROR(Cod::Undefined, "The ground truth file %s has an unknown version", path.c_str());
+
+   GroundTruth truth;
+   truth.markerSize = Size2i(head.markerWidth, head.markerHeight);
+   truth.frameSize = Size2i(head.frameWidth, head.frameHeight);
+   truth.records.resize(head.count);
+   if(head.count > 0)
+      in.read(reinterpret_cast<char*>(&truth.records[0]), head.count * sizeof(GroundTruthRecord));
+   if(!in.good())
+      AVR_FMT_ERROR(Cod::Undefined, "The ground truth file %s is truncated", path.c_str());
+   return truth;
+}
+
+void GroundTruth::Write(const std::string& path) const {
+   FileHeader head;
+   std::memset(&head, 0, sizeof(head));
+   std::memcpy(head.magic, MAGIC, sizeof(MAGIC));
+   head.version = VERSION;
+   head.count = uint32_t(this->records.size());
+   head.markerWidth = this->markerSize.width;
+   head.markerHeight = this->markerSize.height;
+   head.frameWidth = this->frameSize.width;
+   head.frameHeight = this->frameSize.height;
+
+   std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+   if(!out.is_open())
+      AVR_FMT_ERROR(Cod::Undefined, "It did not open the file %s to write the ground truth", path.c_str());
+
+   out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+   if(!this->records.empty())
+      out.write(reinterpret_cast<const char*>(&this->records[0]), this->records.size() * sizeof(GroundTruthRecord));
+   if(!out.good())
+      AVR_FMT_ERROR(Cod::Undefined, "It did not write the ground truth file %s", path.c_str());
+}
+
+double GroundTruth::CornerError(const GroundTruthRecord& truth, const Coords2D& corners) {
+   AVR_ASSERT(corners.size() == 4);
+   double sum = 0.0;
+   for(size_t k = 0; k < 4; k++) {
+      double dx = corners[k].x - truth.corners[2*k], dy = corners[k].y - truth.corners[2*k + 1];
+      sum += std::sqrt(dx*dx + dy*dy);
+   }
+   return sum / 4.0;
+}
+
+} // namespace avr
@@ -1,5 +1,6 @@
 #include <opencv2/nonfree/features2d.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include <avr/track/Algorithms.hpp>
 #include <avr/track/Marker.hpp>
@@ -8,16 +9,52 @@ namespace avr {
 
 using std::string;
 
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                            Frame                                                             *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+const Mat& Frame::Gray() const {
+   if(!this->hasGray && !this->image.empty()) {
+      if(this->image.channels() == 1)
+         this->gray = this->image;
+      else
+         cv::cvtColor(this->image, this->gray, (this->image.channels() == 4) ? CV_BGRA2GRAY : CV_BGR2GRAY);
+      this->hasGray = true;
+   }
+   return this->gray;
+}
+
+const vector<Mat>& Frame::Pyramid(const SystemAlgorithms& methods) const {
+   if(!this->hasPyramid && !this->image.empty()) {
+      methods.Pyramid(this->Gray(), this->pyramid);
+      this->hasPyramid = true;
+   }
+   return this->pyramid;
+}
+
+void Frame::Reset() {
+   // a gray image that is the image itself must not be overwritten by the next conversion
+   if(this->gray.data == this->image.data)
+      this->gray.release();
+   this->keys.clear();
+   // the descriptors belong to the keypoints of the previous image
+   this->descriptor.release();
+   this->hasGray = this->hasPyramid = false;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                            Marker                                                            *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
 // static
 size_t Marker::counter = 0;
 
-Marker::Marker(const Size2i& size, const Coords2D& keys, const cv::Mat& descs, const SPtr<Model>& model)
-: id(counter++), lost(true), world(Coords2D(4)), keys(keys), descriptor(descs), model(model) {
+Marker::Marker(const Size2i& size, const Coords2D& keys, const cv::Mat& descs, const SPtr<MatchIndex>& index, const SPtr<Model>& model)
+: id(counter++), world(Coords2D(4)), keys(keys), descriptor(descs), index(index), model(model) {
    this->world[0] = cv::Point2f(0.0, 0.0);
    this->world[1] = cv::Point2f(size.width, 0.0);
    this->world[2] = cv::Point2f(size.width, size.height);
    this->world[3] = cv::Point2f(0.0, size.height);
-   this->model->Scale(0.60 * size.width);
 }
 
 Size2i Marker::GetSize() const {
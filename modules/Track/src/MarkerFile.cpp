@@ -0,0 +1,263 @@
+#include <opencv2/core/core.hpp>
+
+#include <avr/track/MarkerFile.hpp>
+#include <avr/track/Marker.hpp>
+
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+
+#if defined(_WIN32) || defined(WIN32)
+   #include <windows.h>
+#else
+   #include <fcntl.h>
+   #include <unistd.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+#endif
+
+namespace avr {
+
+namespace {
+
+const char     MAGIC[8] = "AVRMKDB";
+const uint32_t ROW_ALIGN = 32;
+const uint64_t BLOCK_ALIGN = 64;
+
+struct FileHeader {
+   char     magic[8];
+   uint32_t version;
+   uint32_t count;
+   uint64_t hash;
+   int32_t  descType;
+   int32_t  descCols;
+   uint32_t rowStride;
+   uint32_t reserved;
+};
+
+struct MarkerRecord {
+   int32_t  width;
+   int32_t  height;
+   uint32_t keys;
+   uint32_t rows;
+   uint64_t keysOffset;
+   uint64_t descOffset;
+};
+
+inline uint64_t align(uint64_t value, uint64_t n) {
+   return (value + n - 1) & ~(n - 1);
+}
+
+inline const FileHeader& header(const uchar* data) {
+   return * reinterpret_cast<const FileHeader*>(data);
+}
+
+inline const MarkerRecord& record(const uchar* data, size_t i) {
+   return reinterpret_cast<const MarkerRecord*>(data + sizeof(FileHeader))[i];
+}
+
+void pad(std::ofstream& out, uint64_t offset) {
+   static const char zeros[BLOCK_ALIGN] = {0};
+   while(uint64_t(out.tellp()) < offset)
+      out.write(zeros, std::min<uint64_t>(BLOCK_ALIGN, offset - uint64_t(out.tellp())));
+}
+
+// FNV-1a
+uint64_t hash(uint64_t h, const char* str) {
+   for(; *str; str++) {
+      h ^= uchar(*str);
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+void unmap(const uchar* data, size_t length, void* handle) {
+#if defined(_WIN32) || defined(WIN32)
+   UnmapViewOfFile(data);
+   CloseHandle(handle);
+#else
+   munmap(const_cast<uchar*>(data), length);
+#endif
+}
+
+} // namespace
+
+uint64_t MarkerFile::Hash(const SystemAlgorithms& methods) {
+   // the keypoints budget is only applied to the scene frames, the marker images do not depend on it
+   std::ostringstream config;
+   config << (methods.detector.Null() ? "none" : methods.detector->Config()) << ";"
+          << (methods.extractor.Null() ? "none" : methods.extractor->Config()) << ";";
+   return hash(14695981039346656037ULL, config.str().c_str());
+}
+
+void MarkerFile::Write(const std::string& path, const vector<Marker>& markers, const SystemAlgorithms& methods) {
+   FileHeader head;
+   std::memset(&head, 0, sizeof(head));
+   std::memcpy(head.magic, MAGIC, sizeof(MAGIC));
+   head.version = VERSION;
+   head.count = uint32_t(markers.size());
+   head.hash = Hash(methods);
+   head.descType = -1;
+
+   for(const Marker& mk : markers) {
+      if(mk.descriptor.empty()) continue;
+      if(head.descType < 0) {
+         head.descType = mk.descriptor.type();
+         head.descCols = mk.descriptor.cols;
+      } else if(head.descType != mk.descriptor.type() || head.descCols != mk.descriptor.cols) {
+         AVR_ERROR(Cod::FunctionArgument, "All markers must have the same descriptor format");
+      }
+   }
+   if(head.descType >= 0)
+      head.rowStride = uint32_t(align(CV_ELEM_SIZE(head.descType) * head.descCols, ROW_ALIGN));
+
+   // layout, the descriptors of all markers follow the keypoints of all markers
+   vector<MarkerRecord> records(markers.size());
+   uint64_t offset = align(sizeof(FileHeader) + records.size() * sizeof(MarkerRecord), BLOCK_ALIGN);
+   for(size_t i = 0; i < markers.size(); i++) {
+      MarkerRecord& rec = records[i];
+      Size2i size = markers[i].GetSize();
+      rec.width = size.width;
+      rec.height = size.height;
+      rec.keys = uint32_t(markers[i].keys.size());
+      rec.rows = uint32_t(markers[i].descriptor.rows);
+      rec.keysOffset = offset;
+      offset = align(offset + rec.keys * 2 * sizeof(float), BLOCK_ALIGN);
+   }
+   for(auto& rec : records) {
+      rec.descOffset = offset;
+      offset += uint64_t(rec.rows) * head.rowStride;
+   }
+   offset = align(offset, BLOCK_ALIGN);
+
+   std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+   if(!out.is_open())
+      AVR_FMT_ERROR(Cod::Undefined, "It did not open the file %s to write the markers", path.c_str());
+
+   out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+   if(!records.empty())
+      out.write(reinterpret_cast<const char*>(&records[0]), records.size() * sizeof(MarkerRecord));
+
+   for(size_t i = 0; i < markers.size(); i++) {
+      pad(out, records[i].keysOffset);
+      for(const Point2f& p : markers[i].keys) {
+         float xy[2] = { p.x, p.y };
+         out.write(reinterpret_cast<const char*>(xy), sizeof(xy));
+      }
+   }
+   for(size_t i = 0; i < markers.size(); i++) {
+      const Marker& mk = markers[i];
+      pad(out, records[i].descOffset);
+      for(int r = 0; r < mk.descriptor.rows; r++) {
+         out.write(reinterpret_cast<const char*>(mk.descriptor.ptr(r)), mk.descriptor.cols * mk.descriptor.elemSize());
+         pad(out, records[i].descOffset + uint64_t(r + 1) * head.rowStride);
+      }
+   }
+   pad(out, offset);
+
+   if(!out.good())
+      AVR_FMT_ERROR(Cod::Undefined, "It did not write the file %s", path.c_str());
+}
+
+SPtr<MarkerFile> MarkerFile::Open(const std::string& path) {
+   return new MarkerFile(path);
+}
+
+MarkerFile::MarkerFile(const std::string& path) : data(nullptr), length(0), handle(nullptr) {
+#if defined(_WIN32) || defined(WIN32)
+   HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+   if(file == INVALID_HANDLE_VALUE)
+      AVR_FMT_ERROR(Cod::Undefined, "It did not open the marker database %s", path.c_str());
+   LARGE_INTEGER size;
+   GetFileSizeEx(file, &size);
+   this->length = size_t(size.QuadPart);
+   this->handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+   CloseHandle(file);
+   if(this->handle != NULL)
+      this->data = static_cast<const uchar*>(MapViewOfFile(this->handle, FILE_MAP_READ, 0, 0, 0));
+   if(this->data == NULL) {
+      if(this->handle != NULL) CloseHandle(this->handle);
+      AVR_FMT_ERROR(Cod::Undefined, "It did not map the marker database %s", path.c_str());
+   }
+#else
+   int fd = open(path.c_str(), O_RDONLY);
+   if(fd < 0)
+      AVR_FMT_ERROR(Cod::Undefined, "It did not open the marker database %s", path.c_str());
+   struct stat st;
+   fstat(fd, &st);
+   this->length = size_t(st.st_size);
+   void* addr = (this->length > 0) ? mmap(NULL, this->length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+   close(fd);
+   if(addr == MAP_FAILED)
+      AVR_FMT_ERROR(Cod::Undefined, "It did not map the marker database %s", path.c_str());
+   this->data = static_cast<const uchar*>(addr);
+#endif
+
+   // validates header and records before any access, the descriptor rows must fit their stride
+   bool valid = this->length >= sizeof(FileHeader)
+             && std::memcmp(header(data).magic, MAGIC, sizeof(MAGIC)) == 0
+             && header(data).version == VERSION
+             && this->length >= sizeof(FileHeader) + uint64_t(header(data).count) * sizeof(MarkerRecord);
+   if(valid && header(data).descType >= 0) {
+      const FileHeader& head = header(data);
+      valid = head.descType == CV_MAT_TYPE(head.descType) && CV_MAT_DEPTH(head.descType) <= CV_64F && head.descCols > 0
+           && uint64_t(head.rowStride) >= uint64_t(head.descCols) * CV_ELEM_SIZE(head.descType);
+   }
+   for(size_t i = 0; valid && i < this->Size(); i++) {
+      const MarkerRecord& rec = record(data, i);
+      // the offsets are compared before adding them, so a corrupt offset does not wrap around
+      valid = rec.keysOffset <= this->length && uint64_t(rec.keys) * 2 * sizeof(float) <= this->length - rec.keysOffset
+           && rec.descOffset <= this->length && uint64_t(rec.rows) * header(data).rowStride <= this->length - rec.descOffset
+           && (rec.rows == 0 || header(data).descType >= 0);
+   }
+   if(!valid) {
+      unmap(this->data, this->length, this->handle);
+      this->data = nullptr;
+      AVR_FMT_ERROR(Cod::Undefined, "%s is not a valid marker database (version %u)", path.c_str(), VERSION);
+   }
+   // each keypoint has its descriptor row
+   for(size_t i = 0; i < this->Size(); i++) {
+      const MarkerRecord& rec = record(data, i);
+      if(rec.keys == rec.rows) continue;
+      unmap(this->data, this->length, this->handle);
+      this->data = nullptr;
+      AVR_FMT_ERROR(Cod::Undefined, "%s is not a valid marker database, the marker %u has %u keypoints and %u descriptors",
+                    path.c_str(), unsigned(i), rec.keys, rec.rows);
+   }
+}
+
+MarkerFile::~MarkerFile() {
+   if(this->data != nullptr)
+      unmap(this->data, this->length, this->handle);
+}
+
+size_t MarkerFile::Size() const {
+   return header(this->data).count;
+}
+
+uint64_t MarkerFile::GetHash() const {
+   return header(this->data).hash;
+}
+
+Size2i MarkerFile::GetSize(size_t i) const {
+   AVR_ASSERT(i < this->Size());
+   return Size2i(record(this->data, i).width, record(this->data, i).height);
+}
+
+vector<Point2f> MarkerFile::GetKeys(size_t i) const {
+   AVR_ASSERT(i < this->Size());
+   const MarkerRecord& rec = record(this->data, i);
+   const Point2f* keys = reinterpret_cast<const Point2f*>(this->data + rec.keysOffset);
+   return vector<Point2f>(keys, keys + rec.keys);
+}
+
+Mat MarkerFile::GetDescriptor(size_t i) const {
+   AVR_ASSERT(i < this->Size());
+   const MarkerRecord& rec = record(this->data, i);
+   if(rec.rows == 0) return Mat();
+   const FileHeader& head = header(this->data);
+   return Mat(rec.rows, head.descCols, head.descType, const_cast<uchar*>(this->data + rec.descOffset), head.rowStride);
+}
+
+} // namespace avr
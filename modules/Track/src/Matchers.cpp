@@ -0,0 +1,378 @@
+#include <opencv2/core/core.hpp>
+
+#include <avr/track/Algorithms.hpp>
+
+#include <cmath>
+#include <limits>
+#include <cstring>
+#include <stdint.h>
+
+// x86 kernels are compiled with function target attributes and chosen at runtime
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+   #include <immintrin.h>
+   #define AVR_X86_DISPATCH
+#endif // x86
+
+namespace avr {
+
+namespace {
+
+//! Number of train rows processed by block, 256 rows of 64 bytes fits in L1 cache
+const int TRAIN_BLOCK = 256;
+//! Minimum number of query rows given to each thread
+const int QUERY_STRIPE = 32;
+
+//! Number of train rows multiplied at once by the L2 matcher
+const int GEMM_BLOCK = 1024;
+
+//! Two nearest neighbours of a query descriptor
+template <typename Tp>
+struct Top2 {
+   Tp best, second;
+   int index;
+
+   Top2() : best(std::numeric_limits<Tp>::max()), second(std::numeric_limits<Tp>::max()), index(-1) {/* ctor */}
+
+   inline void Update(Tp dist, int idx) {
+      if(dist < best) {
+         second = best;
+         best = dist;
+         index = idx;
+      } else if(dist < second) {
+         second = dist;
+      }
+   }
+};
+
+/**
+ * Hamming kernel: updates the neighbours of the query row with its distances to a block of train rows
+ * @param query  [in] Query row
+ * @param train  [in] First train row of the block
+ * @param step   [in] Train step in bytes
+ * @param rows   [in] Number of train rows in the block
+ * @param bytes  [in] Descriptor length in bytes
+ * @param offset [in] Index of the first train row of the block
+ * @param top    [in/out] Nearest neighbours found until now
+ */
+typedef void (*HammingKernel)(const uchar* query, const uchar* train, size_t step, int rows, int bytes, int offset, Top2<int>& top);
+
+inline uint64_t load64(const uchar* p) {
+   uint64_t v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+inline int popcount64(uint64_t x) {
+   x = x - ((x >> 1) & 0x5555555555555555ULL);
+   x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+   x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+   return int((x * 0x0101010101010101ULL) >> 56);
+}
+
+void hammingScalar(const uchar* query, const uchar* train, size_t step, int rows, int bytes, int offset, Top2<int>& top) {
+   for(int r = 0; r < rows; r++, train += step) {
+      int dist = 0, i = 0;
+      for(; i + 8 <= bytes; i += 8)
+         dist += popcount64(load64(query + i) ^ load64(train + i));
+      for(; i < bytes; i++)
+         dist += popcount64(query[i] ^ train[i]);
+      top.Update(dist, offset + r);
+   }
+}
+
+#ifdef AVR_X86_DISPATCH
+
+__attribute__((target("sse4.2,popcnt")))
+void hammingSSE42(const uchar* query, const uchar* train, size_t step, int rows, int bytes, int offset, Top2<int>& top) {
+   for(int r = 0; r < rows; r++, train += step) {
+      int dist = 0, i = 0;
+      for(; i + 8 <= bytes; i += 8)
+         dist += __builtin_popcountll(load64(query + i) ^ load64(train + i));
+      for(; i < bytes; i++)
+         dist += __builtin_popcount(query[i] ^ train[i]);
+      top.Update(dist, offset + r);
+   }
+}
+
+// popcount by nibble lookup table (Mula et al.), each 32 bytes are reduced with a single sad
+__attribute__((target("avx2,popcnt")))
+void hammingAVX2(const uchar* query, const uchar* train, size_t step, int rows, int bytes, int offset, Top2<int>& top) {
+   const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+   const __m256i low = _mm256_set1_epi8(0x0f);
+   const __m256i zero = _mm256_setzero_si256();
+
+   for(int r = 0; r < rows; r++, train += step) {
+      __m256i acc = zero;
+      int i = 0;
+      for(; i + 32 <= bytes; i += 32) {
+         __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(query + i)),
+                                      _mm256_loadu_si256((const __m256i*)(train + i)));
+         __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low)),
+                                       _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+         acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, zero));
+      }
+      __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+      int dist = _mm_cvtsi128_si32(sum) + _mm_extract_epi32(sum, 2);
+      for(; i + 8 <= bytes; i += 8)
+         dist += __builtin_popcountll(load64(query + i) ^ load64(train + i));
+      for(; i < bytes; i++)
+         dist += __builtin_popcount(query[i] ^ train[i]);
+      top.Update(dist, offset + r);
+   }
+}
+
+#endif // AVR_X86_DISPATCH
+
+HammingKernel selectHammingKernel() {
+#ifdef AVR_X86_DISPATCH
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+      return hammingAVX2;
+   if(__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+      return hammingSSE42;
+#endif // AVR_X86_DISPATCH
+   return hammingScalar;
+}
+
+const HammingKernel hammingKernel = selectHammingKernel();
+
+//! Splits the query rows among threads, each one sweeps the train descriptors block by block
+class HammingBody : public cv::ParallelLoopBody {
+public:
+   HammingBody(const Mat& query, const Mat& train, vector<Top2<int> >& tops) :
+      query(query), train(train), tops(tops) {/* ctor */}
+
+   void operator() (const cv::Range& range) const {
+      for(int t = 0; t < train.rows; t += TRAIN_BLOCK) {
+         int rows = std::min(TRAIN_BLOCK, train.rows - t);
+         const uchar* block = train.ptr<uchar>(t);
+         for(int q = range.start; q < range.end; q++)
+            hammingKernel(query.ptr<uchar>(q), block, train.step, rows, train.cols, t, tops[q]);
+      }
+   }
+
+private:
+   const Mat& query;
+   const Mat& train;
+   vector<Top2<int> >& tops;
+};
+
+/**
+ * L1 kernel: updates the neighbours of the query row with its distances to a block of train rows
+ * @param step [in] Train step in floats, the other parameters are the same of HammingKernel
+ */
+typedef void (*L1Kernel)(const float* query, const float* train, size_t step, int rows, int cols, int offset, Top2<float>& top);
+
+void l1Scalar(const float* query, const float* train, size_t step, int rows, int cols, int offset, Top2<float>& top) {
+   for(int r = 0; r < rows; r++, train += step) {
+      float dist = 0.0f;
+      for(int i = 0; i < cols; i++)
+         dist += std::abs(query[i] - train[i]);
+      top.Update(dist, offset + r);
+   }
+}
+
+#ifdef AVR_X86_DISPATCH
+
+// absolute differences by clearing the sign bit, two accumulators hide the add latency
+__attribute__((target("avx2")))
+void l1AVX2(const float* query, const float* train, size_t step, int rows, int cols, int offset, Top2<float>& top) {
+   const __m256 abs = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+   for(int r = 0; r < rows; r++, train += step) {
+      __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+      int i = 0;
+      for(; i + 16 <= cols; i += 16) {
+         acc0 = _mm256_add_ps(acc0, _mm256_and_ps(abs, _mm256_sub_ps(_mm256_loadu_ps(query + i), _mm256_loadu_ps(train + i))));
+         acc1 = _mm256_add_ps(acc1, _mm256_and_ps(abs, _mm256_sub_ps(_mm256_loadu_ps(query + i + 8), _mm256_loadu_ps(train + i + 8))));
+      }
+      for(; i + 8 <= cols; i += 8)
+         acc0 = _mm256_add_ps(acc0, _mm256_and_ps(abs, _mm256_sub_ps(_mm256_loadu_ps(query + i), _mm256_loadu_ps(train + i))));
+      acc0 = _mm256_add_ps(acc0, acc1);
+      __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+      sum = _mm_hadd_ps(sum, sum);
+      sum = _mm_hadd_ps(sum, sum);
+      float dist = _mm_cvtss_f32(sum);
+      for(; i < cols; i++)
+         dist += std::abs(query[i] - train[i]);
+      top.Update(dist, offset + r);
+   }
+}
+
+#endif // AVR_X86_DISPATCH
+
+L1Kernel selectL1Kernel() {
+#ifdef AVR_X86_DISPATCH
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+      return l1AVX2;
+#endif // AVR_X86_DISPATCH
+   return l1Scalar;
+}
+
+const L1Kernel l1Kernel = selectL1Kernel();
+
+//! L1 matching, the same blocking scheme of HammingBody
+class L1Body : public cv::ParallelLoopBody {
+public:
+   L1Body(const Mat& query, const Mat& train, vector<Top2<float> >& tops) :
+      query(query), train(train), tops(tops) {/* ctor */}
+
+   void operator() (const cv::Range& range) const {
+      const size_t step = train.step / sizeof(float);
+      for(int t = 0; t < train.rows; t += TRAIN_BLOCK) {
+         int rows = std::min(TRAIN_BLOCK, train.rows - t);
+         const float* block = train.ptr<float>(t);
+         for(int q = range.start; q < range.end; q++)
+            l1Kernel(query.ptr<float>(q), block, step, rows, train.cols, t, tops[q]);
+      }
+   }
+
+private:
+   const Mat& query;
+   const Mat& train;
+   vector<Top2<float> >& tops;
+};
+
+/**
+ * L2 matching, each thread multiplies its query rows by blocks of train rows and ranks ||t||^2 - 2q.t,
+ * the query norm is the same for all candidates so it is added only to the selected neighbours
+ */
+class L2Body : public cv::ParallelLoopBody {
+public:
+   L2Body(const Mat& query, const Mat& train, const vector<float>& trainNorms, vector<Top2<float> >& tops) :
+      query(query), train(train), trainNorms(trainNorms), tops(tops) {/* ctor */}
+
+   void operator() (const cv::Range& range) const {
+      Mat stripe = query.rowRange(range);
+      Mat products;
+      for(int t = 0; t < train.rows; t += GEMM_BLOCK) {
+         int rows = std::min(GEMM_BLOCK, train.rows - t);
+         cv::gemm(stripe, train.rowRange(t, t + rows), 1.0, Mat(), 0.0, products, cv::GEMM_2_T);
+         for(int q = range.start; q < range.end; q++) {
+            const float* prod = products.ptr<float>(q - range.start);
+            const float* norms = &trainNorms[t];
+            Top2<float>& top = tops[q];
+            for(int j = 0; j < rows; j++)
+               top.Update(norms[j] - 2.0f * prod[j], t + j);
+         }
+      }
+   }
+
+private:
+   const Mat& query;
+   const Mat& train;
+   const vector<float>& trainNorms;
+   vector<Top2<float> >& tops;
+};
+
+//! Squared L2 norm of each row
+void squaredNorms(const Mat& descriptors, vector<float>& norms) {
+   norms.resize(descriptors.rows);
+   for(int i = 0; i < descriptors.rows; i++) {
+      const float* row = descriptors.ptr<float>(i);
+      float sum = 0.0f;
+      for(int j = 0; j < descriptors.cols; j++)
+         sum += row[j] * row[j];
+      norms[i] = sum;
+   }
+}
+
+//! Query descriptors with its squared norms
+class NormIndex : public MatchIndex {
+public:
+   explicit NormIndex(const Mat& descriptors) : MatchIndex(descriptors) {
+      squaredNorms(descriptors, this->norms);
+   }
+
+   vector<float> norms;
+};
+
+//! L2 matching given the query squared norms
+void matchL2(const Mat& query, const vector<float>& queryNorms, const Mat& train, float ratio, vector<cv::DMatch>& goodMatches) {
+   vector<float> trainNorms;
+   squaredNorms(train, trainNorms);
+
+   vector<Top2<float> > tops(query.rows);
+   cv::parallel_for_(cv::Range(0, query.rows), L2Body(query, train, trainNorms, tops), double(query.rows) / QUERY_STRIPE);
+
+   for(int i = 0; i < query.rows; i++) {
+      const Top2<float>& top = tops[i];
+      if(top.index < 0) continue;
+      float best = std::sqrt(std::max(0.0f, top.best + queryNorms[i]));
+      float second = (top.second == std::numeric_limits<float>::max()) ? top.second
+                                                                        : std::sqrt(std::max(0.0f, top.second + queryNorms[i]));
+      if(best < ratio * second)
+         goodMatches.push_back(cv::DMatch(i, top.index, best));
+   }
+}
+
+} // namespace
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Hamming Matcher                                                            *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+void HammingMatcher::operator() (const Mat& query, const Mat& train, vector<cv::DMatch>& goodMatches) const {
+   if(query.empty() || train.empty()) return;
+   AVR_ASSERT(query.type() == CV_8U && train.type() == CV_8U && query.cols == train.cols);
+
+   vector<Top2<int> > tops(query.rows);
+   cv::parallel_for_(cv::Range(0, query.rows), HammingBody(query, train, tops), double(query.rows) / QUERY_STRIPE);
+
+   for(int i = 0; i < query.rows; i++) {
+      const Top2<int>& top = tops[i];
+      if(top.index >= 0 && top.best < this->ratio * top.second)
+         goodMatches.push_back(cv::DMatch(i, top.index, float(top.best)));
+   }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                    Float Matcher                                                             *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+FloatMatcher::FloatMatcher(int _normType, float _ratio) : DescriptorMatcher(),
+   normType(_normType), ratio(_ratio) {
+   if(_normType != cv::NORM_L1 && _normType != cv::NORM_L2)
+      AVR_ERROR(Cod::BadFlag, "FloatMatcher supports only NORM_L1 and NORM_L2");
+}
+
+void FloatMatcher::operator() (const Mat& query, const Mat& train, vector<cv::DMatch>& goodMatches) const {
+   if(query.empty() || train.empty()) return;
+   AVR_ASSERT(query.type() == CV_32F && train.type() == CV_32F && query.cols == train.cols);
+
+   if(this->normType == cv::NORM_L2) {
+      vector<float> queryNorms;
+      squaredNorms(query, queryNorms);
+      matchL2(query, queryNorms, train, this->ratio, goodMatches);
+      return;
+   }
+
+   vector<Top2<float> > tops(query.rows);
+   cv::parallel_for_(cv::Range(0, query.rows), L1Body(query, train, tops), double(query.rows) / QUERY_STRIPE);
+
+   for(int i = 0; i < query.rows; i++) {
+      const Top2<float>& top = tops[i];
+      if(top.index >= 0 && top.best < this->ratio * top.second)
+         goodMatches.push_back(cv::DMatch(i, top.index, top.best));
+   }
+}
+
+void FloatMatcher::operator() (const MatchIndex& query, const Mat& train, vector<cv::DMatch>& goodMatches) const {
+   const NormIndex* index = dynamic_cast<const NormIndex*>(&query);
+   if(index == NULL || query.descriptors.empty() || train.empty()) {
+      (*this)(query.descriptors, train, goodMatches);
+      return;
+   }
+   AVR_ASSERT(train.type() == CV_32F && query.descriptors.cols == train.cols);
+   matchL2(query.descriptors, index->norms, train, this->ratio, goodMatches);
+}
+
+SPtr<MatchIndex> FloatMatcher::Index(const Mat& query) const {
+   if(this->normType == cv::NORM_L2 && query.type() == CV_32F)
+      return new NormIndex(query);
+   return new MatchIndex(query);
+}
+
+} // namespace avr
@@ -0,0 +1,37 @@
+#include <opencv2/core/core.hpp>
+
+#include <avr/track/Motion.hpp>
+
+namespace avr {
+
+void MotionModel::Update(const Matx33d& homography) {
+   this->lastHomography[0] = this->lastHomography[1];
+   this->lastHomography[1] = homography;
+   this->homographies++;
+}
+
+void MotionModel::Update(const TMatx& pose) {
+   this->lastPose[0] = this->lastPose[1];
+   this->lastPose[1] = pose;
+   this->poses++;
+}
+
+Matx33d MotionModel::Motion() const {
+   if(!this->Ready()) return Matx33d::eye();
+   // frame to frame motion of the last pair, H1 = M * H0
+   Matx33d motion = this->lastHomography[1] * this->lastHomography[0].inv();
+   return motion * (1.0 / motion(2, 2));
+}
+
+Matx33d MotionModel::Predict() const {
+   AVR_ASSERT(this->Ready());
+   return this->Motion() * this->lastHomography[1];
+}
+
+TMatx MotionModel::PredictPose() const {
+   AVR_ASSERT(this->Posed());
+   // the camera moves again as it moved between the last two frames
+   return this->lastPose[1] * this->lastPose[0].Inv() * this->lastPose[1];
+}
+
+} // namespace avr
@@ -1,57 +1,728 @@
 #include <opencv2/nonfree/features2d.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include <avr/track/Tracking.hpp>
+#include <avr/core/Profiler.hpp>
+#include <avr/core/Trace.hpp>
 
-#define WINDOWS_BORDER_SIZE   50
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#define WINDOWS_BORDER_SIZE   50    // pixels around the points of a marker given to the optical flow
+#define REGIONS_MAX_AREA      0.6   // fraction of the frame, above it the whole frame is pyramided
+#define COARSE_MIN_RATIO      0.66  // the coarse pass runs only if it downscales the frame at least this much
+#define COARSE_MIN_MATCHES    8     // verified matches of a marker on the coarse pass to search it at full resolution
+#define ASYNC_HISTORY_SIZE    16
 
 namespace avr {
 
-Marker HybridTracker::Registry(const PreMarker& mk) const {
-   Mat image = cv::imread(mk.path, cv::IMREAD_GRAYSCALE);
+namespace {
+
+// merges the rectangles that overlap until none of them does
+void merge(vector<Rect2i>& rects) {
+   for(bool merged = true; merged; ) {
+      merged = false;
+      for(size_t i = 0; i < rects.size() && !merged; i++) {
+         for(size_t j = i + 1; j < rects.size() && !merged; j++) {
+            if((rects[i] & rects[j]).area() > 0) {
+               rects[i] |= rects[j];
+               rects.erase(rects.begin() + j);
+               merged = true;
+            }
+         }
+      }
+   }
+}
+
+// bounding rectangle of the points, widened by a border on each side
+Rect2i bounds(const Coords2D& points, int border) {
+   float x0 = points[0].x, y0 = points[0].y, x1 = x0, y1 = y0;
+   for(const auto& p : points) {
+      x0 = std::min(x0, p.x); x1 = std::max(x1, p.x);
+      y0 = std::min(y0, p.y); y1 = std::max(y1, p.y);
+   }
+   return Rect2i(cv::Point(int(std::floor(x0)) - border, int(std::floor(y0)) - border),
+                 cv::Point(int(std::ceil(x1)) + border + 1, int(std::ceil(y1)) + border + 1));
+}
+
+// the rectangle widened to the size of the first level of a pyramid, so its buffers are built again in place, inside the frame
+Rect2i fit(const Rect2i& rect, const vector<Mat>& pyramid, const Size2i& frame) {
+   if(pyramid.empty()) return rect;
+   const Size2i held = pyramid[0].size();
+   const int width = std::min(std::max(rect.width, held.width), frame.width);
+   const int height = std::min(std::max(rect.height, held.height), frame.height);
+   const int x = std::max(0, std::min(rect.x - (width - rect.width)/2, frame.width - width));
+   const int y = std::max(0, std::min(rect.y - (height - rect.height)/2, frame.height - height));
+   return Rect2i(x, y, width, height);
+}
+
+// a marker has at most one match per keypoint, so its buffers do not grow while it is tracked
+void reserve(MarkerTrack& track, size_t keys) {
+   track.matches.reserve(keys);
+   track.flow.reserve(keys);
+   track.error.reserve(keys);
+}
+
+} // namespace
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Marker Database                                                            *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+void MarkerDatabase::Add(const Marker& marker) {
+   if(marker.descriptor.empty()) return;
+   AVR_ASSERT(this->descriptors.empty() || this->descriptors.type() == marker.descriptor.type());
+   AVR_ASSERT(marker.keys.size() == size_t(marker.descriptor.rows));
+
+   this->offsets.push_back(this->descriptors.rows);
+   this->ids.push_back(marker.id);
+   this->sizes.push_back(marker.GetSize());
+
+   // the descriptors of a mapped file follow each other, so the joint descriptors stay a view of the file
+   Mat& joint = this->descriptors;
+   const Mat& descs = marker.descriptor;
+   if(!marker.source.Null() && joint.empty()) {
+      joint = descs;
+      this->mapped = marker.source;
+   } else if(!marker.source.Null() && this->mapped == marker.source && joint.step == descs.step
+             && joint.data + joint.rows * joint.step[0] == descs.data) {
+      joint = Mat(joint.rows + descs.rows, joint.cols, joint.type(), joint.data, joint.step);
+   } else {
+      joint.push_back(descs);
+      this->mapped = nullptr;
+   }
+   this->indexes.push_back(marker.index);
+   this->keys.insert(this->keys.end(), marker.keys.begin(), marker.keys.end());
+   this->index = nullptr;
+}
+
+bool MarkerDatabase::Contains(size_t id) const {
+   return std::find(this->ids.begin(), this->ids.end(), id) != this->ids.end();
+}
+
+void MarkerDatabase::Match(const SystemAlgorithms& methods, const Mat& scene, const vector<size_t>& lost,
+                          std::map<size_t, vector<cv::DMatch> >& matches) {
+   matches.clear();
+   for(size_t id : lost)
+      if(this->Contains(id)) matches[id].clear();
+   if(this->descriptors.empty() || scene.empty() || matches.empty()) return;
+
+   if(!methods.Searched() && matches.size() < this->ids.size()) {
+      // a brute force query costs each of its rows, the tracked markers are not matched
+      for(auto& it : matches) {
+         size_t k = std::find(this->ids.begin(), this->ids.end(), it.first) - this->ids.begin();
+         methods.Match(*this->indexes[k], scene, it.second);
+         for(auto& m : it.second)
+            m.imgIdx = int(it.first);
+      }
+      return;
+   }
+
+   if(this->index.Null())
+      this->index = methods.Index(this->descriptors);
+
+   vector<cv::DMatch> joint;
+   methods.Match(*this->index, scene, joint);
+
+   // dispatches each match to its marker, the ones of the tracked markers are dropped
+   for(auto& it : joint) {
+      size_t k = std::upper_bound(this->offsets.begin(), this->offsets.end(), it.queryIdx) - this->offsets.begin() - 1;
+      auto found = matches.find(this->ids[k]);
+      if(found == matches.end()) continue;
+      it.queryIdx -= this->offsets[k];
+      it.imgIdx = int(this->ids[k]);
+      found->second.push_back(it);
+   }
+}
+
+void MarkerDatabase::Verify(std::map<size_t, vector<cv::DMatch> >& matches, const Coords2D& scene,
+                            std::map<size_t, Rect2i>* regions) const {
+   Coords2D targetPts, scenePts; vector<uchar> inliers;
+   for(auto& it : matches) {
+      vector<cv::DMatch>& mtc = it.second;
+      if(mtc.size() < 4) { mtc.clear(); continue; }
+
+      size_t k = std::find(this->ids.begin(), this->ids.end(), it.first) - this->ids.begin();
+      AVR_ASSERT(k < this->ids.size());
+      AVR_TRACE_MARKER(it.first);
+
+      targetPts.clear(); scenePts.clear();
+      for(const auto& m : mtc) {
+         targetPts.push_back(this->keys[this->offsets[k] + m.queryIdx]);
+         scenePts.push_back(scene[m.trainIdx]);
+      }
+      Mat homography;
+      {
+         AVR_TRACE_SCOPE("findHomography");
+         homography = cv::findHomography(targetPts, scenePts, cv::RANSAC, 4, inliers);
+      }
+      if(homography.empty()) { mtc.clear(); continue; }
+      if(regions != nullptr) {
+         const Size2i& size = this->sizes[k];
+         Coords2D corners = { Point2f(0, 0), Point2f(size.width, 0), Point2f(size.width, size.height), Point2f(0, size.height) };
+         Coords2D projected;
+         cv::perspectiveTransform(corners, projected, homography);
+         (*regions)[it.first] = bounds(projected, 0);
+      }
+
+      size_t n = 0;
+      for(size_t i = 0; i < mtc.size(); i++)
+         if(inliers[i]) mtc[n++] = mtc[i];
+      mtc.resize(n);
+   }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Frame History                                                              *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+FrameHistory::FrameHistory(size_t capacity) : frames(std::max<size_t>(capacity, 2)), head(0), count(0) {/* ctor */}
+
+void FrameHistory::Push(const Frame& frame) {
+   this->head = (this->head + 1) % this->frames.size();
+   // reuses the old frame, its images are released only if no one else refers them
+   this->frames[this->head] = frame;
+   this->count = std::min(this->count + 1, this->frames.size());
+}
+
+void FrameHistory::Clear() {
+   for(auto& frame : this->frames)
+      frame = Frame();
+   this->head = this->count = 0;
+}
+
+const Frame& FrameHistory::operator [] (size_t age) const {
+   AVR_ASSERT(age < this->count);
+   return this->frames[(this->head + this->frames.size() - age) % this->frames.size()];
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Frame Pool                                                                 *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+namespace {
+
+// the counter is read with the same atomic operation OpenCV uses to change it, other threads may be releasing the buffer
+inline bool unique(const Mat& m, int owners = 1) {
+   return m.refcount == nullptr || CV_XADD(m.refcount, 0) <= owners;
+}
+
+// a frame is free when its buffers are referred only by itself
+bool available(const Frame& frame, const Mat& gray, const vector<Mat>& pyramid) {
+   bool alias = !gray.empty() && gray.data == frame.image.data;
+   if(!unique(frame.image, alias ? 2 : 1) || !(alias || unique(gray)) || !unique(frame.descriptor))
+      return false;
+   // each level and its derivatives are separate buffers
+   for(const auto& level : pyramid)
+      if(!unique(level)) return false;
+   return true;
+}
+
+} // namespace
+
+FramePool::FramePool(size_t size, size_t keys) : frames(std::max<size_t>(size, 1)), next(0), keys(keys) {
+   for(auto& frame : this->frames)
+      frame.keys.reserve(keys);
+}
+
+Frame& FramePool::Acquire() {
+   for(size_t n = 0; n < this->frames.size(); n++) {
+      Frame& frame = this->frames[this->next];
+      this->next = (this->next + 1) % this->frames.size();
+      if(available(frame, frame.gray, frame.pyramid)) {
+         frame.Reset();
+         return frame;
+      }
+   }
+   // all frames are in use, a new one is allocated only this time
+   this->frames.push_back(Frame());
+   this->frames.back().keys.reserve(this->keys);
+   this->next = 0;
+   return this->frames.back();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------*\
+*                                                   Hybrid Tracker                                                             *
+\*----------------------------------------------------------------------------------------------------------------------------*/
+
+HybridTracker::~HybridTracker() {
+   if(this->job.valid())
+      this->job.wait();
+}
+
+void HybridTracker::SetAsync(bool enable) {
+   if(enable == this->async) return;
+   if(this->job.valid())
+      this->job.wait();
+   this->job = std::future<Relocalization>();
+   this->relocated.clear();
+
+   this->async = enable;
+   // the propagation needs the frames since the snapshot
+   this->history = FrameHistory(enable ? ASYNC_HISTORY_SIZE : FrameHistory().Capacity());
+   this->worker = enable ? new ThreadPool(1) : nullptr;
+}
+
+Marker HybridTracker::Registry(const PreMarker& mk) {
+   return this->Registry(this->Prepare(mk.path), mk.model);
+}
+
+MarkerFeatures HybridTracker::Prepare(const std::string& path) const {
+   Mat image = cv::imread(path, cv::IMREAD_GRAYSCALE);
    if(image.empty()) {
       AVR_ERROR(Cod::Undefined, "It did not read the image file to build the marker");
    }
-   vector<cv::KeyPoint> keys; Mat descs;
-   methods.Detect(image, keys);
-   methods.Extract(image, keys, descs);
+   vector<cv::KeyPoint> keys;
+   MarkerFeatures features;
+   methods.DetectAndExtract(image, keys, features.descriptor);
+
+   cv::KeyPoint::convert(keys, features.keys);
+   features.size = image.size();
+   // the marker's descriptors do not change, so the matcher prepares them only once
+   features.index = methods.Index(features.descriptor);
+   return features;
+}
+
+Marker HybridTracker::Registry(const MarkerFeatures& features, const SPtr<Model>& model) {
+   Marker marker(features.size, features.keys, features.descriptor, features.index, model);
+   this->database.Add(marker);
+   this->sightings[marker.id] = Sighting();
+   return marker;
+}
 
-   vector<Point2f> points;
-   cv::KeyPoint::convert(keys, points);
+vector<Marker> HybridTracker::Registry(const SPtr<MarkerFile>& file, const SPtr<Model>& model) {
+   if(file->GetHash() != MarkerFile::Hash(this->methods)) {
+      AVR_ERROR(Cod::FunctionArgument, "The marker database was written with other detection and extraction algorithms");
+   }
 
-   return Marker(image.size(), points, descs, mk.model);
+   vector<Marker> markers;
+   markers.reserve(file->Size());
+   for(size_t i = 0; i < file->Size(); i++) {
+      // the descriptors are used from the mapped memory, the marker keeps the file alive. A search index is only built
+      // for the joint descriptors of the database, the brute force matchers prepare each marker for its own query
+      Mat descs = file->GetDescriptor(i);
+      SPtr<MatchIndex> index = this->methods.Searched() ? SPtr<MatchIndex>(nullptr) : this->methods.Index(descs);
+      Marker marker(file->GetSize(i), file->GetKeys(i), descs, index, model);
+      marker.source = file;
+      this->database.Add(marker);
+      this->sightings[marker.id] = Sighting();
+      markers.push_back(marker);
+   }
+   return markers;
 }
 
 bool HybridTracker::Update(Frame& frame) {
-   if(!frame.image.empty() && this->oneLost) {
-      vector<cv::KeyPoint> keys;
-      methods.Detect(frame.image, keys);
-      methods.Extract(frame.image, keys, frame.descriptor);
-      cv::KeyPoint::convert(keys, frame.keys);
+   AVR_PROFILE_SCOPE("track.update");
+   this->frameMatches.clear();
+   this->ClearRegions();
+
+   if(frame.image.empty()) return false;
+
+   // the gray image is converted before the markers use it at the same time, the pyramids are built only around
+   // the tracked markers by FindAll and around the relocated points by the asynchronous propagation
+   frame.Gray();
+
+   if(this->async) {
+      this->history.Push(frame);
+      this->sequence++;
+      // the propagated matches are valid only for the frame they were propagated to
+      this->relocated.clear();
+
+      // a new localization starts only when the last one has not just found the markers
+      bool reconciled = this->Reconcile();
+      if(this->oneLost && !reconciled && !this->job.valid()) {
+         this->Relocalize(frame);
+         this->oneLost = false;
+         return true;
+      }
+      return false;
+   }
+
+   bool extracted = false;
+   if(this->oneLost) {
+      AVR_PROFILE_COUNT("track.extractions", 1);
+      vector<Rect2i> windows;
+      bool whole = !this->SearchWindows(frame.Gray().size(), windows);
+      const vector<size_t> lost = this->LostMarkers();
+      this->Features(frame.Gray(), windows, whole, lost, this->keypoints, frame.descriptor);
+      cv::KeyPoint::convert(this->keypoints, frame.keys);
+
+      // a single matching pass for all lost markers
+      if(this->database.Size() > 0)
+         this->database.Match(this->methods, frame.descriptor, lost, this->frameMatches);
 
       this->oneLost = false;
-      return true;
+      extracted = true;
+   }
+
+   this->history.Push(frame);
+   this->sequence++;
+   return extracted;
+}
+
+bool HybridTracker::SearchWindows(const Size2i& frame, vector<Rect2i>& windows) const {
+   windows.clear();
+   if(this->sightings.empty()) return false;
+
+   const Rect2i whole(0, 0, frame.width, frame.height);
+   double area = 0.0;
+   for(const auto& it : this->sightings) {
+      const Sighting& sight = it.second;
+      if(!sight.lost) continue;
+      size_t age = this->sequence - sight.sequence;
+      if(!sight.seen || age > this->search.recentFrames) return false;
+
+      // the window widens with the frames since the marker was last found
+      int border = WINDOWS_BORDER_SIZE + int(this->search.growth * age * std::max(sight.region.width, sight.region.height));
+      Rect2i window(sight.region.x - border, sight.region.y - border, sight.region.width + 2*border, sight.region.height + 2*border);
+      window &= whole;
+      if(window.area() > 0) windows.push_back(window);
+   }
+   merge(windows);
+   for(const auto& window : windows)
+      area += window.area();
+   return area <= REGIONS_MAX_AREA * whole.area();
+}
+
+vector<size_t> HybridTracker::LostMarkers() const {
+   vector<size_t> lost;
+   for(const auto& it : this->sightings)
+      if(it.second.lost) lost.push_back(it.first);
+   return lost;
+}
+
+void HybridTracker::Features(const Mat& gray, vector<Rect2i> windows, bool whole, const vector<size_t>& lost,
+                             vector<cv::KeyPoint>& keys, Mat& descs) {
+   AVR_TRACE_SCOPE("Features");
+   const Rect2i frame(0, 0, gray.cols, gray.rows);
+   const double scale = double(this->search.coarseWidth) / gray.cols;
+
+   if(whole && this->search.coarseWidth > 0 && scale < COARSE_MIN_RATIO && !this->coarseMissed) {
+      // coarse pass: the markers found on the downscaled frame give the regions detected at full resolution
+      Mat small;
+      cv::resize(gray, small, cv::Size(), scale, scale, cv::INTER_AREA);
+      this->methods.DetectAndExtract(small, keys, descs);
+
+      Coords2D scene;
+      cv::KeyPoint::convert(keys, scene);
+      for(auto& p : scene)
+         p *= 1.0 / scale;
+
+      std::map<size_t, vector<cv::DMatch> > coarse;
+      std::map<size_t, Rect2i> regions;
+      if(this->database.Size() > 0) {
+         this->database.Match(this->methods, descs, lost, coarse);
+         this->database.Verify(coarse, scene, &regions);
+      }
+      windows.clear();
+      for(const auto& it : regions) {
+         if(coarse[it.first].size() < COARSE_MIN_MATCHES) continue;
+         const Rect2i& r = it.second;
+         Rect2i window = Rect2i(r.x - WINDOWS_BORDER_SIZE, r.y - WINDOWS_BORDER_SIZE, r.width + 2*WINDOWS_BORDER_SIZE, r.height + 2*WINDOWS_BORDER_SIZE) & frame;
+         if(window.area() > 0) windows.push_back(window);
+      }
+      // a frame without any marker on the coarse pass is searched at full resolution the next time
+      this->coarseMissed = windows.empty();
+      merge(windows);
+   } else if(whole) {
+      this->coarseMissed = false;
+      windows.assign(1, frame);
+   }
+
+   keys.clear();
+   descs.release();
+   vector<cv::KeyPoint> local;
+   Mat localDescs;
+   if(!this->methods.budget.Active()) {
+      for(const auto& window : windows) {
+         Mat crop = gray(window);
+         this->methods.DetectAndExtract(crop, local, localDescs);
+         if(local.empty()) continue;
+         for(auto& k : local)
+            k.pt += Point2f(window.x, window.y);
+         keys.insert(keys.end(), local.begin(), local.end());
+         descs.push_back(localDescs);
+      }
+      return;
+   }
+
+   // the budget is for the whole frame, so the keypoints of all windows are culled together before any extraction
+   vector<cv::KeyPoint> detected;
+   for(const auto& window : windows) {
+      this->methods.Detect(gray(window), local);
+      for(auto& k : local)
+         k.pt += Point2f(window.x, window.y);
+      detected.insert(detected.end(), local.begin(), local.end());
+   }
+   this->methods.budget.Apply(gray.size(), detected);
+
+   // the merged windows do not overlap, each kept keypoint is extracted in its own window
+   for(const auto& window : windows) {
+      const Point2f origin(window.x, window.y);
+      local.clear();
+      for(const auto& k : detected) {
+         if(k.pt.x < origin.x || k.pt.y < origin.y || k.pt.x >= origin.x + window.width || k.pt.y >= origin.y + window.height) continue;
+         local.push_back(k);
+         local.back().pt -= origin;
+      }
+      if(local.empty()) continue;
+      this->methods.Extract(gray(window), local, localDescs);
+      for(auto& k : local)
+         k.pt += origin;
+      keys.insert(keys.end(), local.begin(), local.end());
+      descs.push_back(localDescs);
+   }
+}
+
+void HybridTracker::Relocalize(const Frame& frame) {
+   // the snapshot shares the gray image, the frame pool does not recycle it while the worker uses it
+   Mat snapshot = frame.Gray();
+   size_t seq = this->sequence, number = frame.number;
+   // the sightings are read here, the worker would race with Find
+   vector<Rect2i> windows;
+   bool whole = !this->SearchWindows(snapshot.size(), windows);
+   const vector<size_t> lost = this->LostMarkers();
+
+   this->job = this->worker->Submit([this, snapshot, seq, number, windows, whole, lost]() {
+      Tracer::Instance().SetThreadName("relocalization");
+      Tracer::SetFrame(number);
+      Relocalization result;
+      result.sequence = seq;
+
+      vector<cv::KeyPoint> keys; Mat descs;
+      this->Features(snapshot, windows, whole, lost, keys, descs);
+      cv::KeyPoint::convert(keys, result.scene);
+
+      // only the worker uses the database while the localization runs
+      if(this->database.Size() > 0) {
+         this->database.Match(this->methods, descs, lost, result.matches);
+         this->database.Verify(result.matches, result.scene);
+      }
+      return result;
+   });
+}
+
+bool HybridTracker::Reconcile() {
+   if(!this->job.valid() || this->job.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      return false;
+
+   Relocalization result = this->job.get();
+   size_t age = this->sequence - result.sequence;
+   // the flow since the snapshot is no longer kept
+   if(age >= this->history.Size()) return false;
+
+   bool found = false;
+   FlowRegion& region = this->propagation;
+   for(auto& it : result.matches) {
+      if(it.second.size() <= 20) continue;
+      // a marker tracked since the snapshot is already on the current frame
+      auto sight = this->sightings.find(it.first);
+      if(sight != this->sightings.end() && !sight->second.lost) continue;
+
+      Relocated& rel = this->relocated[it.first];
+      rel.matches.swap(it.second);
+      rel.scene.clear();
+      for(const auto& m : rel.matches)
+         rel.scene.push_back(result.scene[m.trainIdx]);
+
+      // propagates the scene points through the flow from the snapshot to the current frame, each step pyramids
+      // only a region around the points, as the tracking does
+      for(size_t a = age; a > 0 && !rel.scene.empty(); a--) {
+         const Mat& from = this->history[a].Gray();
+         const Mat& to = this->history[a - 1].Gray();
+         region.rect = fit(bounds(rel.scene, WINDOWS_BORDER_SIZE) & Rect2i(0, 0, to.cols, to.rows), region.curr, to.size());
+         if(region.rect.area() == 0) { rel.scene.clear(); break; }
+         this->methods.Pyramid(from(region.rect), region.prev);
+         this->methods.Pyramid(to(region.rect), region.curr);
+
+         const Point2f origin(region.rect.x, region.rect.y);
+         for(auto& p : rel.scene)
+            p -= origin;
+         this->tracked.clear(); this->error.clear();
+         this->methods.Track(region.prev, rel.scene, region.curr, this->tracked, this->error);
+
+         size_t k = 0;
+         for(size_t i = 0; i < this->error.size(); i++) {
+            if(0.0f <= this->error[i]) {
+               rel.matches[k] = rel.matches[i];
+               rel.scene[k++] = this->tracked[i] + origin;
+            }
+         }
+         rel.matches.resize(k);
+         rel.scene.resize(k);
+      }
+      found = found || rel.scene.size() > 20;
    }
-   return false;
+   return found;
 }
 
-Matches HybridTracker::Find(const Marker& target, const Frame& scene) {
-   bool found = (target.lost) ? this->Localize(target, scene, target.lastMatches)
-                              : this->Track(target, scene, target.lastMatches);
+const Matches& HybridTracker::Find(const Marker& target, const Frame& scene) {
+   AVR_TRACE_MARKER(target.id);
+   MarkerTrack& track = target.track;
+   bool found = (track.lost) ? this->Localize(target, scene, track)
+                             : this->Track(target, scene, track);
 
-   this->oneLost = !found;
+   // each marker changes only its own entry
+   auto sight = this->sightings.find(target.id);
+   if(sight != this->sightings.end()) {
+      Sighting& it = sight->second;
+      it.lost = !found;
+      if(found) {
+         it.seen = true;
+         it.sequence = this->sequence;
+         it.region = bounds(track.matches._scenePts, 0);
+      }
+   }
+
+   // any lost marker requires the features of the next frame
+   if(!found) {
+      this->oneLost = true;
+      AVR_PROFILE_COUNT("track.lost", 1);
+   }
 
-   // backup and exit
-   scene.image.copyTo(this->prevScene);
-   return target.lastMatches;
+   return track.matches;
 }
 
-bool HybridTracker::Localize(const Marker& target, const Frame& scene, Matches& out) {
+namespace {
+
+class FindBody : public cv::ParallelLoopBody {
+public:
+   FindBody(HybridTracker& tracker, const vector<Marker>& markers, const Frame& scene) :
+      tracker(tracker), markers(markers), scene(scene), frame(Tracer::GetFrame()) {/* ctor */}
+
+   void operator() (const cv::Range& range) const {
+      // the trace tag of the calling thread is passed to the parallel workers
+      if(frame >= 0) Tracer::SetFrame(size_t(frame));
+      for(int i = range.start; i < range.end; i++)
+         tracker.Find(markers[i], scene);
+   }
+
+private:
+   HybridTracker& tracker;
+   const vector<Marker>& markers;
+   const Frame& scene;
+   long frame;
+};
+
+} // namespace
+
+void HybridTracker::FindAll(const vector<Marker>& markers, const Frame& scene) {
+   this->PrepareRegions(markers);
+   cv::parallel_for_(cv::Range(0, int(markers.size())), FindBody(*this, markers, scene));
+}
+
+Rect2i HybridTracker::Region(const MarkerTrack& track, const Size2i& frame) {
+   const Coords2D& points = track.matches._scenePts;
+   if(points.empty()) return Rect2i();
+
+   Rect2i box = bounds(points, 0);
+   if(track.motion.Ready()) {
+      // the predicted points are inside the predicted box, the box is convex under the motion
+      const Matx33d motion = track.motion.Motion();
+      const cv::Vec3d corners[4] = { cv::Vec3d(box.x, box.y, 1.0), cv::Vec3d(box.br().x, box.y, 1.0),
+                                     cv::Vec3d(box.br().x, box.br().y, 1.0), cv::Vec3d(box.x, box.br().y, 1.0) };
+      for(const auto& corner : corners) {
+         cv::Vec3d moved = motion * corner;
+         Point2f p(moved[0] / moved[2], moved[1] / moved[2]);
+         box |= Rect2i(cv::Point(int(std::floor(p.x)), int(std::floor(p.y))), cv::Point(int(std::ceil(p.x)) + 1, int(std::ceil(p.y)) + 1));
+      }
+   }
+   Rect2i region(box.x - WINDOWS_BORDER_SIZE, box.y - WINDOWS_BORDER_SIZE, box.width + 2*WINDOWS_BORDER_SIZE, box.height + 2*WINDOWS_BORDER_SIZE);
+   return region & Rect2i(0, 0, frame.width, frame.height);
+}
+
+void HybridTracker::ClearRegions() {
+   for(size_t i = 0; i < this->regionsCount; i++) {
+      FlowRegion& region = this->regions[i];
+      if(!region.shared) continue;
+      region.prev.clear();
+      region.curr.clear();
+      region.shared = false;
+   }
+   this->regionsCount = 0;
+}
+
+void HybridTracker::PrepareRegions(const vector<Marker>& markers) {
+   this->ClearRegions();
+   if(this->history.Size() < 2) return;
+   const Frame& prev = this->history[1];
+   const Frame& curr = this->history[0];
+   const Size2i size = curr.Gray().size();
+
+   vector<Rect2i>& rects = this->regionRects;
+   rects.clear();
+   for(const auto& marker : markers) {
+      if(marker.track.lost) continue;
+      Rect2i rect = Region(marker.track, size);
+      if(rect.area() > 0) rects.push_back(rect);
+   }
+   // the overlapping regions are merged, so their pixels are pyramided only once
+   merge(rects);
+
+   double area = 0.0;
+   for(const auto& rect : rects)
+      area += rect.area();
+   if(area > REGIONS_MAX_AREA * size.area()) {
+      // the markers cover most of the frame, its whole pyramids are cheaper and kept by the history
+      if(this->regions.empty()) this->regions.resize(1);
+      FlowRegion& whole = this->regions[0];
+      whole.rect = Rect2i(0, 0, size.width, size.height);
+      whole.prev = prev.Pyramid(this->methods);
+      whole.curr = curr.Pyramid(this->methods);
+      whole.shared = true;
+      this->regionsCount = 1;
+      return;
+   }
+
+   // the regions are only added, and each one keeps the largest size it had, so the buffers of its pyramids are
+   // rebuilt in place by the next frames instead of allocated again for every new size
+   if(this->regions.size() < rects.size())
+      this->regions.resize(rects.size());
+   this->regionsCount = rects.size();
+   for(size_t i = 0; i < rects.size(); i++) {
+      FlowRegion& region = this->regions[i];
+      region.rect = fit(rects[i], region.curr, size);
+      this->methods.Pyramid(prev.Gray()(region.rect), region.prev);
+      this->methods.Pyramid(curr.Gray()(region.rect), region.curr);
+   }
+}
+
+// The map entries are only swapped, never inserted or erased, so different markers can be localized at the same time
+bool HybridTracker::Localize(const Marker& target, const Frame& scene, MarkerTrack& track) {
+   AVR_PROFILE_SCOPE("track.localize");
+   Matches& out = track.matches;
+   if(this->async) {
+      // the asynchronous localization never blocks, the marker waits the result propagated to this frame
+      out.clear();
+      auto rel = this->relocated.find(target.id);
+      if(rel == this->relocated.end()) return false;
+
+      Relocated taken;
+      std::swap(taken, rel->second);
+      reserve(track, target.keys.size());
+      for(size_t i = 0; i < taken.matches.size(); i++) {
+         out._targetPts.push_back(target.keys[taken.matches[i].queryIdx]);
+         out._scenePts.push_back(taken.scene[i]);
+         out._error.push_back(taken.matches[i].distance);
+      }
+      return out.size() > 20;
+   }
+
    vector<cv::DMatch> matches;
-   methods.Match(target.descriptor, scene.descriptor, matches);
+   auto joint = this->frameMatches.find(target.id);
+   if(joint != this->frameMatches.end())
+      matches.swap(joint->second);
+   else if(!target.index.Null())
+      methods.Match(*target.index, scene.descriptor, matches);
+   else
+      methods.Match(target.descriptor, scene.descriptor, matches);
 
    out.clear();
+   reserve(track, target.keys.size());
    for(auto& it : matches) {
       out._targetPts.push_back(target.keys[it.queryIdx]);
       out._scenePts.push_back(scene.keys[it.trainIdx]);
@@ -61,17 +732,60 @@ bool HybridTracker::Localize(const Marker& target, const Frame& scene, Matches&
    return matches.size() > 20;
 }
 
-bool HybridTracker::Track(const Marker& target, const Frame& scene, Matches& inout) {
-   vector<Point2f> currPoints; vector<float> error;
-   this->methods.Track(this->prevScene, inout._scenePts, scene.image, currPoints, error);
+bool HybridTracker::Track(const Marker& target, const Frame& scene, MarkerTrack& track) {
+   AVR_PROFILE_SCOPE("track.lk");
+   // every marker is tracked from the same previous frame, whatever the order of the calls
+   if(this->history.Size() < 2) return false;
+   Matches& inout = track.matches;
+   track.flow.clear(); track.error.clear();
+
+   const Rect2i roi = Region(track, this->history[0].Gray().size());
+   if(roi.area() == 0) return false;
+
+   // the region prepared by FindAll that contains the marker, or its own one in the marker's buffers (Find may run concurrently)
+   const FlowRegion* region = nullptr;
+   for(size_t i = 0; i < this->regionsCount; i++) {
+      if((this->regions[i].rect & roi) == roi) {
+         region = &this->regions[i];
+         break;
+      }
+   }
+   const Rect2i rect = region ? region->rect : fit(roi, track.currRegion, this->history[0].Gray().size());
+   if(region == nullptr) {
+      this->methods.Pyramid(this->history[1].Gray()(rect), track.prevRegion);
+      this->methods.Pyramid(this->history[0].Gray()(rect), track.currRegion);
+   }
+   const vector<Mat>& prevPyramid = region ? region->prev : track.prevRegion;
+   const vector<Mat>& currPyramid = region ? region->curr : track.currRegion;
+
+   // the points are given in the region coordinates
+   const Point2f origin(rect.x, rect.y);
+   for(auto& p : inout._scenePts)
+      p -= origin;
+
+   if(track.motion.Ready()) {
+      // the flow starts where the motion of the last frames puts the points
+      cv::Matx33d toRegion(1.0, 0.0, -origin.x, 0.0, 1.0, -origin.y, 0.0, 0.0, 1.0);
+      cv::Matx33d toFrame(1.0, 0.0, origin.x, 0.0, 1.0, origin.y, 0.0, 0.0, 1.0);
+      cv::perspectiveTransform(inout._scenePts, track.flow, toRegion * track.motion.Motion() * toFrame);
+      float predicted = 0.0f;
+      for(size_t i = 0; i < track.flow.size(); i++) {
+         Point2f d = track.flow[i] - inout._scenePts[i];
+         predicted = std::max(predicted, d.x*d.x + d.y*d.y);
+      }
+      float expected = MOTION_UNCERTAINTY * std::sqrt(predicted) + MOTION_MARGIN;
+      this->methods.Track(prevPyramid, inout._scenePts, currPyramid, track.flow, track.error, expected);
+   } else {
+      this->methods.Track(prevPyramid, inout._scenePts, currPyramid, track.flow, track.error);
+   }
 
    // Filtra os pontos que foram rastreados pelo status
    size_t k = 0;
-   for(size_t i = 0; i < error.size(); i++) {
-      if(0.0f <= error[i]) {
+   for(size_t i = 0; i < track.error.size(); i++) {
+      if(0.0f <= track.error[i]) {
          inout._targetPts[k] = inout._targetPts[i];
-         inout._scenePts[k] = currPoints[i];
-         inout._error[k++] = error[i];
+         inout._scenePts[k] = track.flow[i] + origin;
+         inout._error[k++] = track.error[i];
       }
    }
    inout._scenePts.resize(k);
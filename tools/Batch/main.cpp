@@ -0,0 +1,351 @@
+/**
+ * Headless batch tracker, it tracks the markers on recorded videos or image sequences without any display or GL context
+ *
+ * Usage: AVRBatch [options] <video|sequence> [<video|sequence> ...]
+ *    -m <image>     marker image (repeatable)
+ *    -d <file>      marker database written by AVRMarkerDB (repeatable)
+ *    -c <file>      camera calibration file, the poses are estimated only if it is given
+ *    -a <mode>      balanced|performance|quality algorithms (default is balanced)
+ *    -o <dir>       output directory (default is the current one)
+ *    -b             binary output instead of CSV
+ *    -j <n>         number of files processed at the same time (default is the number of cores)
+ *    -g             reads the ground truth of each input (groundtruth.bin in its directory, see AVRSynth) and
+ *                   reports the corner error and the recall of the first marker
+ * An image sequence is given by a printf-like pattern, e.g. frames/img_%04d.png
+ *
+ * For each input it writes one record per frame and marker: frame, marker index (the order of -m and then -d),
+ * state (1 tracked, 0 lost), number of matches, the four scene corners and the 4x4 pose matrix by row (zeros when not
+ * estimated). The index is the same in every output, the marker IDs depend on the registration order of the jobs.
+ */
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#include <avr/core/ThreadPool.hpp>
+#include <avr/camera/Camera.hpp>
+#include <avr/track/Tracking.hpp>
+#include <avr/track/MarkerFile.hpp>
+#include <avr/track/GroundTruth.hpp>
+
+#if defined(_WIN32) || defined(WIN32)
+   #include <windows.h>
+   #include <psapi.h>
+#else
+   #include <sys/resource.h>
+#endif
+
+using namespace avr;
+
+using std::cout;
+using std::cerr;
+using std::string;
+
+namespace {
+
+enum Stage { DECODE, UPDATE, FIND, POSE, WRITE, STAGES };
+const char* STAGE_NAMES[STAGES] = { "decode", "update", "find", "pose", "write" };
+
+const char     MAGIC[8] = "AVRTRCK";
+const uint32_t VERSION = 1;
+
+struct Record {
+   uint32_t frame;
+   uint32_t marker;
+   uint32_t state;
+   uint32_t matches;
+   float    corners[8];
+   double   pose[16];
+};
+
+struct Job {
+   string input;
+   string output;
+   SPtr<HybridTracker> tracker;
+   vector<Marker> markers;
+   SPtr<Camera> camera;
+   GroundTruth truth;
+   bool hasTruth;
+
+   // results
+   size_t frames;
+   double seconds;
+   double stages[STAGES];
+   double cornerError;   // sum in pixels, only with ground truth
+   size_t located;       // frames where the first marker was located with the marker visible
+   size_t visible;       // frames with the first marker visible
+   string error;
+};
+
+size_t peakRSS() {
+#if defined(_WIN32) || defined(WIN32)
+   PROCESS_MEMORY_COUNTERS pmc;
+   GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+   return pmc.PeakWorkingSetSize;
+#else
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   return size_t(usage.ru_maxrss) * 1024;   // Linux gives it in kilobytes
+#endif
+}
+
+// ground truth file of an input, it is in the same directory
+string truthName(const string& input) {
+   size_t end = input.find_last_of("/\\");
+   return (end == string::npos ? string(".") : input.substr(0, end)) + "/groundtruth.bin";
+}
+
+// output file name given the input one, the path and the extension are removed
+string outputName(const string& dir, const string& input, bool binary) {
+   size_t begin = input.find_last_of("/\\");
+   string name = input.substr(begin == string::npos ? 0 : begin + 1);
+   name = name.substr(0, name.find_last_of('.'));
+   for(auto& c : name)
+      if(c == '%') c = '_';
+   return dir + "/" + name + (binary ? ".bin" : ".csv");
+}
+
+void write(std::ofstream& out, const Record& rec, bool binary) {
+   if(binary) {
+      out.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+      return;
+   }
+   out << rec.frame << ',' << rec.marker << ',' << rec.state << ',' << rec.matches;
+   for(float c : rec.corners) out << ',' << c;
+   for(double p : rec.pose) out << ',' << p;
+   out << '\n';
+}
+
+void run(Job& job, bool binary) {
+   cv::VideoCapture cap(job.input);
+   if(!cap.isOpened()) {
+      job.error = "it did not open";
+      return;
+   }
+   std::ofstream out(job.output.c_str(), binary ? std::ios::binary : std::ios::out);
+   if(!out.is_open()) {
+      job.error = "it did not open the output " + job.output;
+      return;
+   }
+
+   if(binary) {
+      uint32_t head[2] = { VERSION, uint32_t(sizeof(Record)) };
+      out.write(MAGIC, sizeof(MAGIC));
+      out.write(reinterpret_cast<const char*>(head), sizeof(head));
+   } else {
+      out << "frame,marker,state,matches,x0,y0,x1,y1,x2,y2,x3,y3";
+      for(int i = 0; i < 16; i++) out << ",p" << i / 4 << i % 4;
+      out << '\n';
+   }
+
+   FramePool frames;
+   Coords3D world;
+   Coords2D location;
+   vector<uchar> inliers;
+   Record rec;
+   double freq = cv::getTickFrequency();
+   int64 start = cv::getTickCount();
+
+   for(job.frames = 0; ; job.frames++) {
+      int64 ticks[STAGES + 1];
+      ticks[DECODE] = cv::getTickCount();
+      Frame& scene = frames.Acquire();
+      cap >> scene.image;
+      if(scene.image.empty()) break;
+
+      ticks[UPDATE] = cv::getTickCount();
+      job.tracker->Update(scene);
+
+      ticks[FIND] = cv::getTickCount();
+      job.tracker->FindAll(job.markers, scene);
+
+      ticks[POSE] = cv::getTickCount();
+      vector<Record> records(job.markers.size());
+      for(size_t i = 0; i < job.markers.size(); i++) {
+         Marker& marker = job.markers[i];
+         const Matches& result = marker.GetMatches();
+         marker.SetLost(result.size() <= 20);
+
+         std::memset(&rec, 0, sizeof(rec));
+         rec.frame = uint32_t(job.frames);
+         rec.marker = uint32_t(i);
+         rec.state = marker.Lost() ? 0 : 1;
+         rec.matches = uint32_t(result.size());
+
+         if(result.size() >= 4) {
+            Coords2D corners;
+            Mat homography = cv::findHomography(result.targetPts(), result.scenePts(), cv::RANSAC, 4, inliers);
+            if(homography.empty()) {
+               records[i] = rec;
+               continue;
+            }
+            cv::perspectiveTransform(marker.GetWorld(), corners, homography);
+            // the motion of the tracked marker seeds the optical flow of the next frame
+            if(!marker.Lost()) marker.SetHomography(cv::Matx33d(homography));
+            for(size_t k = 0; k < corners.size() && k < 4; k++) {
+               rec.corners[2*k] = corners[k].x;
+               rec.corners[2*k + 1] = corners[k].y;
+            }
+            if(i == 0 && job.hasTruth && job.frames < job.truth.Size() && job.truth[job.frames].visible && !marker.Lost()) {
+               job.cornerError += GroundTruth::CornerError(job.truth[job.frames], corners);
+               job.located++;
+            }
+
+            if(!job.camera.Null() && corners.size() == 4) {
+               // same pose path of the application, the homography decomposition refined on the inliers
+               Point2f center(marker.GetSize().width/2.0, marker.GetSize().height/2.0);
+               PlanarPose planar = job.camera->PoseFromHomography(cv::Matx33d(homography), center, marker.GetWorld());
+               const MotionModel& motion = marker.GetTrack().motion;
+               const TMatx& initial = motion.Posed() ? planar.Closest(motion.PredictPose()) : planar.poses[0];
+               world.clear(); location.clear();
+               for(size_t k = 0; k < inliers.size(); k++) {
+                  if(!inliers[k]) continue;
+                  world.push_back(Point3f(result.targetPts(k).x - center.x, result.targetPts(k).y - center.y, 0.0f));
+                  location.push_back(result.scenePts(k));
+               }
+
+               TMatx pose = (motion.Posed() && planar.errors[0] > PLANAR_MAX_ERROR && world.size() >= 4)
+                          ? job.camera->Pose(world, location, motion.PredictPose())
+                          : job.camera->Refine(initial, world, location);
+               marker.SetPose(pose);
+               for(int k = 0; k < 16; k++)
+                  rec.pose[k] = pose(k / 4, k % 4);
+            }
+         }
+         records[i] = rec;
+      }
+      if(job.hasTruth && job.frames < job.truth.Size() && job.truth[job.frames].visible)
+         job.visible++;
+
+      ticks[WRITE] = cv::getTickCount();
+      for(const auto& it : records)
+         write(out, it, binary);
+
+      ticks[STAGES] = cv::getTickCount();
+      for(int s = 0; s < STAGES; s++)
+         job.stages[s] += (ticks[s + 1] - ticks[s]) / freq;
+   }
+   job.seconds = (cv::getTickCount() - start) / freq;
+
+   if(!out.good())
+      job.error = "it did not write the output " + job.output;
+}
+
+int usage(const char* name) {
+   cerr << "Usage: " << name << " [-m <marker image>]... [-d <marker database>]... [-c <camera file>]\n"
+        << "       [-a balanced|performance|quality] [-o <output dir>] [-b] [-j <jobs>] [-g] <video|sequence>...\n";
+   return 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+   vector<string> images, databases, inputs;
+   string camera, mode = "balanced", dir = ".";
+   bool binary = false, truth = false;
+   size_t jobs = 0;
+
+   for(int i = 1; i < argc; i++) {
+      string arg = argv[i];
+      bool value = i + 1 < argc;
+      if(arg == "-m" && value)      images.push_back(argv[++i]);
+      else if(arg == "-d" && value) databases.push_back(argv[++i]);
+      else if(arg == "-c" && value) camera = argv[++i];
+      else if(arg == "-a" && value) mode = argv[++i];
+      else if(arg == "-o" && value) dir = argv[++i];
+      else if(arg == "-j" && value) jobs = std::strtoul(argv[++i], nullptr, 10);
+      else if(arg == "-b")          binary = true;
+      else if(arg == "-g")          truth = true;
+      else if(arg[0] == '-')        return usage(argv[0]);
+      else                          inputs.push_back(arg);
+   }
+   if(inputs.empty() || (images.empty() && databases.empty()))
+      return usage(argv[0]);
+
+   bool performance = mode == "performance", quality = mode == "quality";
+   if(!performance && !quality && mode != "balanced") {
+      cerr << "Unknown optimization mode " << mode << "\n";
+      return 1;
+   }
+   SystemAlgorithms methods = SystemAlgorithms::Create(performance, quality);
+
+   // the marker images are prepared only once, for all files
+   vector<MarkerFeatures> features;
+   {
+      HybridTracker preparer(methods);
+      for(const auto& path : images)
+         features.push_back(preparer.Prepare(path));
+   }
+
+   // the jobs are built and destroyed here, the threads do not share smart pointers
+   vector<Job> all(inputs.size());
+   for(size_t i = 0; i < inputs.size(); i++) {
+      Job& job = all[i];
+      job.input = inputs[i];
+      job.output = outputName(dir, inputs[i], binary);
+      job.tracker = new HybridTracker(methods);
+      for(const auto& it : features)
+         job.markers.push_back(job.tracker->Registry(it, nullptr));
+      for(const auto& path : databases) {
+         vector<Marker> stored = job.tracker->Registry(MarkerFile::Open(path), nullptr);
+         job.markers.insert(job.markers.end(), stored.begin(), stored.end());
+      }
+      if(!camera.empty())
+         job.camera = new Camera(camera);
+      job.hasTruth = truth;
+      if(truth) {
+         // a missing or corrupt ground truth only disables the evaluation of this input
+         try {
+            job.truth = GroundTruth::Read(truthName(inputs[i]));
+         } catch(const std::exception& e) {
+            cerr << "Warning: " << inputs[i] << " has no ground truth (" << e.what() << ")\n";
+            job.hasTruth = false;
+         }
+      }
+      job.frames = job.located = job.visible = 0;
+      job.seconds = job.cornerError = 0.0;
+      std::fill(job.stages, job.stages + STAGES, 0.0);
+   }
+
+   int64 start = cv::getTickCount();
+   {
+      ThreadPool pool(std::min<size_t>(jobs > 0 ? jobs : std::thread::hardware_concurrency(), inputs.size()));
+      vector<std::future<void> > done;
+      for(auto& job : all)
+         done.push_back(pool.Submit([&job, binary]() { run(job, binary); }));
+      for(size_t i = 0; i < done.size(); i++) {
+         try { done[i].get(); }
+         catch(const std::exception& e) { all[i].error = e.what(); }
+      }
+   }
+   double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+   // report
+   size_t total = 0;
+   int failed = 0;
+   for(const auto& job : all) {
+      if(!job.error.empty()) {
+         cerr << job.input << ": " << job.error << "\n";
+         failed++;
+         continue;
+      }
+      total += job.frames;
+      cout << job.input << ": " << job.frames << " frames, " << (job.frames / std::max(job.seconds, 1e-9)) << " fps";
+      for(int s = 0; s < STAGES; s++)
+         cout << ", " << STAGE_NAMES[s] << " " << (1000.0 * job.stages[s] / std::max<size_t>(job.frames, 1)) << " ms";
+      if(job.hasTruth)
+         cout << ", corner error " << (job.cornerError / std::max<size_t>(job.located, 1)) << " px"
+              << ", recall " << (double(job.located) / std::max<size_t>(job.visible, 1));
+      cout << "\n";
+   }
+   cout << total << " frames of " << (all.size() - failed) << " files in " << seconds << "s, "
+        << (total / std::max(seconds, 1e-9)) << " fps, peak RSS " << (peakRSS() / (1024.0 * 1024.0)) << " MB\n";
+
+   return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,653 @@
+/**
+ * Per-stage benchmark of the algorithms combinations, it replays the bundled scene videos against their markers
+ *
+ * Usage: AVRBenchmark [-d <data dir>] [-g <synthetic dir>]... [-n <max frames>] [-o <output.json>]
+ *    -d <dir>       directory of the scene videos, the markers and the camera file (default is ../data)
+ *    -g <dir>       synthetic sequence written by AVRSynth, it is replayed after the videos (repeatable)
+ *    -n <frames>    maximum number of frames replayed per video (default is all of them)
+ *    -o <file>      JSON output file (default is the standard output)
+ *
+ * Each frame runs the per-frame path of the application on a HybridTracker: Update ("update", it detects, extracts
+ * and matches when a marker is lost), FindAll ("find", the optical flow of the tracked markers and the localization of
+ * the lost ones), the RANSAC homography ("homography") and the planar pose refined on the inliers ("pose"). The
+ * latencies of each stage and of the whole frame are reported as p50/p95/p99 in milliseconds, with the inliers count,
+ * the ratio of lost frames and the ratio of frames that extracted features.
+ * The synthetic sequences have ground truth, so they also report the corner error in pixels of the located frames
+ * and the recall, the ratio of frames with a visible marker where it was located.
+ *
+ * A build with AVR_PROFILE (the BenchmarkProf target, linked to the TrackLibProf and CameraLibProf libraries) also reports
+ * the probes recorded inside the tracker and the camera ("probes"), e.g. the localization and the flow of each marker.
+ *
+ * The PnP of Camera::Pose on the corners ("pose_pnp") is timed apart, it is not part of the frame. With ground truth
+ * both poses report the rotation error in degrees and the translation error relative to the marker distance.
+ *
+ * The "-nomotion" configuration never feeds the motion model of the marker, so its latencies, inliers and lost frames
+ * compare with the same algorithms seeded by the motion model. The "-async" one localizes on the worker thread.
+ *
+ * The "-reindex" configurations add to each frame that extracted features the build of the FLANN index of the marker
+ * ("index" stage), as before the persistent MatchIndex, so their frame latencies compare with the configurations that
+ * build it once.
+ *
+ * The "engines_cormem" entry replays the first 100 frames of cormem_scene with the OpenCV engines of BRISK, ORB, SIFT
+ * and SURF constructed on each call, as the wrappers did before keeping them ("per_call", with the "construction"
+ * alone), and with the wrappers of SystemAlgorithms that construct them once ("persistent").
+ *
+ * The "scaling_findall" entry replays 200 synthetic 1920x1080 frames with 8 markers visible at once, the quadrants of
+ * both marker images, with 1, 2, 4, 8 and all the cores for the parallel loops of FindAll. It reports the latencies of
+ * FindAll and of the frame, the ratio of located markers and the speedup of the median FindAll over a single thread.
+ *
+ * The "history_1080p" entry compares, on synthetic 1920x1080 frames, keeping the last frames in a FrameHistory by
+ * reference against copying them: the color image copied once per marker as before FrameHistory ("copy_image"), and
+ * the whole frame (image, gray image and pyramid) copied into a ring ("copy_frame"), with the bytes and the bandwidth.
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/features2d/features2d.hpp>
+#include <opencv2/nonfree/features2d.hpp>
+
+#include <avr/core/Profiler.hpp>
+#include <avr/camera/Camera.hpp>
+#include <avr/track/Marker.hpp>
+#include <avr/track/Tracking.hpp>
+#include <avr/track/GroundTruth.hpp>
+
+using namespace avr;
+
+using std::cout;
+using std::cerr;
+using std::string;
+
+namespace {
+
+// INDEX is only run by the configurations that rebuild the marker index on every extraction
+// POSE_PNP is the baseline of the pose, it is not part of the frame time
+enum Stage { UPDATE, FIND, INDEX, HOMOGRAPHY, POSE, POSE_PNP, STAGES };
+const char* STAGE_NAMES[STAGES] = { "update", "find", "index", "homography", "pose", "pose_pnp" };
+
+struct Config {
+   string name;
+   std::function<SystemAlgorithms()> create;
+   bool indexPerFrame;     // the marker index is built again on each extraction instead of once (see MatchIndex)
+   bool noMotion;          // the motion model is never fed, LK starts at the last points with the full search
+   bool async;             // the localization runs on the worker thread (see HybridTracker::SetAsync)
+};
+
+struct Scene {
+   string name;
+   string video;
+   string marker;
+   string camera;
+   string truth;     // ground truth file, empty if there is none
+};
+
+struct Result {
+   vector<double> stages[STAGES];   // milliseconds of each run of the stage
+   vector<double> frameTimes;       // milliseconds of all stages of each frame
+   vector<double> inliers;
+   vector<double> cornerError;      // pixels, only with ground truth
+   vector<double> rotationError[2];     // degrees of the PnP and the application poses, only with ground truth
+   vector<double> translationError[2];  // relative to the true distance, same order
+   vector<ProbeStats> probes;       // probes recorded during the replay, only in AVR_PROFILE builds
+   size_t frames;
+   size_t lost;
+   size_t extractions;              // frames where Update extracted features
+   size_t visible;                  // frames with the marker visible, only with ground truth
+};
+
+double elapsed(int64 start) {
+   return 1000.0 * (cv::getTickCount() - start) / cv::getTickFrequency();
+}
+
+// nearest-rank percentile, the samples are sorted
+double percentile(const vector<double>& sorted, double p) {
+   if(sorted.empty()) return 0.0;
+   size_t rank = size_t(std::ceil(p / 100.0 * sorted.size()));
+   return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+// rotation angle in degrees between the pose and the true one, and the translation error relative to the true distance
+void poseError(const TMatx& pose, const GroundTruthRecord& truth, double& rotation, double& translation) {
+   double trace = 0.0, diff = 0.0, norm = 0.0;
+   for(int i = 0; i < 3; i++) {
+      for(int j = 0; j < 3; j++)
+         trace += pose(j, i) * truth.pose[4*j + i];   // trace(R^T R_truth)
+      double d = pose(i, 3) - truth.pose[4*i + 3];
+      diff += d * d;
+      norm += truth.pose[4*i + 3] * truth.pose[4*i + 3];
+   }
+   rotation = std::acos(std::min(1.0, std::max(-1.0, (trace - 1.0) / 2.0))) * 180.0 / CV_PI;
+   translation = std::sqrt(diff / std::max(norm, 1e-12));
+}
+
+void summary(std::ostream& out, vector<double> samples) {
+   std::sort(samples.begin(), samples.end());
+   double mean = 0.0;
+   for(double s : samples) mean += s;
+   mean /= std::max<size_t>(samples.size(), 1);
+   out << "{\"count\": " << samples.size() << ", \"mean\": " << mean
+       << ", \"p50\": " << percentile(samples, 50) << ", \"p95\": " << percentile(samples, 95)
+       << ", \"p99\": " << percentile(samples, 99) << "}";
+}
+
+Result replay(const SystemAlgorithms& methods, const Config& config, const Scene& scene, size_t maxFrames) {
+   Result result;
+   result.frames = result.lost = result.extractions = result.visible = 0;
+
+   Camera camera(scene.camera);
+   GroundTruth truth;
+   if(!scene.truth.empty())
+      truth = GroundTruth::Read(scene.truth);
+
+   HybridTracker tracker(methods);
+   tracker.SetAsync(config.async);
+   MarkerFeatures features = tracker.Prepare(scene.marker);
+   vector<Marker> markers(1, tracker.Registry(features, nullptr));
+   Marker& marker = markers[0];
+
+   const Coords2D& world = marker.GetWorld();
+   const Point2f center(marker.GetSize().width/2.0, marker.GetSize().height/2.0);
+   Coords3D world3D;
+   for(const auto& p : world)
+      world3D.push_back(Point3f(p.x - center.x, p.y - center.y, 0.0f));
+
+   cv::VideoCapture cap(scene.video);
+   if(!cap.isOpened()) {
+      AVR_ERROR(Cod::Undefined, "It did not open the scene video");
+   }
+
+   FramePool frames;
+   Coords2D corners, location;
+   Coords3D inlierWorld;
+   TMatx poses[2];
+   vector<uchar> inliers;
+   bool located = false;
+   Profiler::Instance().Reset();
+
+   while(result.frames < maxFrames) {
+      Frame& frame = frames.Acquire();
+      cap >> frame.image;
+      if(frame.image.empty()) break;
+      frame.number = result.frames++;
+
+      // the same calls of Application::Process, the decoding is not timed
+      int64 t = cv::getTickCount();
+      bool extracted = tracker.Update(frame);
+      double frameTime = elapsed(t);
+      result.stages[UPDATE].push_back(frameTime);
+      if(extracted) {
+         result.extractions++;
+         if(config.indexPerFrame) {
+            t = cv::getTickCount();
+            SPtr<MatchIndex> index = methods.Index(features.descriptor);
+            result.stages[INDEX].push_back(elapsed(t));
+            frameTime += result.stages[INDEX].back();
+         }
+      }
+
+      t = cv::getTickCount();
+      tracker.FindAll(markers, frame);
+      result.stages[FIND].push_back(elapsed(t));
+      frameTime += result.stages[FIND].back();
+
+      const Matches& found = marker.GetMatches();
+      marker.SetLost(found.size() <= 20);
+      bool tracked = located;
+      located = false;
+      size_t count = 0;
+      if(found.size() >= 4) {
+         t = cv::getTickCount();
+         Mat homography = cv::findHomography(found.targetPts(), found.scenePts(), cv::RANSAC, 4, inliers);
+         result.stages[HOMOGRAPHY].push_back(elapsed(t));
+         frameTime += result.stages[HOMOGRAPHY].back();
+
+         if(!homography.empty()) {
+            count = std::count(inliers.begin(), inliers.end(), 1);
+            cv::perspectiveTransform(world, corners, homography);
+
+            t = cv::getTickCount();
+            PlanarPose planar = camera.PoseFromHomography(cv::Matx33d(homography), center, world);
+            const MotionModel& motion = marker.GetTrack().motion;
+            const TMatx& initial = motion.Posed() ? planar.Closest(motion.PredictPose()) : planar.poses[0];
+            inlierWorld.clear(); location.clear();
+            for(size_t i = 0; i < inliers.size(); i++) {
+               if(!inliers[i]) continue;
+               inlierWorld.push_back(Point3f(found.targetPts(i).x - center.x, found.targetPts(i).y - center.y, 0.0f));
+               location.push_back(found.scenePts(i));
+            }
+            if(motion.Posed() && planar.errors[0] > PLANAR_MAX_ERROR && inlierWorld.size() >= 4)
+               poses[1] = camera.Pose(inlierWorld, location, motion.PredictPose());
+            else
+               poses[1] = camera.Refine(initial, inlierWorld, location);
+            result.stages[POSE].push_back(elapsed(t));
+            frameTime += result.stages[POSE].back();
+
+            if(!config.noMotion) {
+               if(!marker.Lost()) marker.SetHomography(cv::Matx33d(homography));
+               marker.SetPose(poses[1]);
+            }
+
+            // the baseline starts from its last pose while the marker is tracked
+            t = cv::getTickCount();
+            poses[0] = tracked ? camera.Pose(world3D, corners, poses[0]) : camera.Pose(world3D, corners, true);
+            result.stages[POSE_PNP].push_back(elapsed(t));
+            located = !marker.Lost();
+         }
+      }
+      result.frameTimes.push_back(frameTime);
+      result.inliers.push_back(count);
+      if(marker.Lost()) result.lost++;
+
+      size_t n = result.frames - 1;
+      if(n < truth.Size() && truth[n].visible) {
+         result.visible++;
+         if(located) {
+            result.cornerError.push_back(GroundTruth::CornerError(truth[n], corners));
+            for(int k = 0; k < 2; k++) {
+               double rotation, translation;
+               poseError(poses[k], truth[n], rotation, translation);
+               result.rotationError[k].push_back(rotation);
+               result.translationError[k].push_back(translation);
+            }
+         }
+      }
+   }
+
+   for(const auto& probe : Profiler::Instance().Collect())
+      if(probe.count > 0 || probe.counter > 0) result.probes.push_back(probe);
+   return result;
+}
+
+struct HistoryCost {
+   vector<double> reference;     // milliseconds of each FrameHistory::Push
+   vector<double> copyImage;     // milliseconds of each copy of the color image
+   vector<double> copyFrame;     // milliseconds of each copy of the image, gray image and pyramid
+   size_t imageBytes;
+   size_t frameBytes;
+};
+
+HistoryCost historyCost(const SystemAlgorithms& methods, size_t frames) {
+   HistoryCost cost;
+   FrameHistory history;
+
+   // more source frames than the ring keeps, so the copies do not come from the cache
+   vector<Frame> sources(history.Capacity() + 1);
+   for(auto& frame : sources) {
+      frame.image.create(1080, 1920, CV_8UC3);
+      cv::randu(frame.image, cv::Scalar::all(0), cv::Scalar::all(256));
+      frame.Pyramid(methods);
+   }
+   cost.imageBytes = sources[0].image.total() * sources[0].image.elemSize();
+   cost.frameBytes = cost.imageBytes + sources[0].Gray().total();
+   for(const auto& level : sources[0].Pyramid(methods))
+      cost.frameBytes += level.total() * level.elemSize();
+
+   Mat prevScene;
+   vector<vector<Mat> > ring(history.Capacity());   // image, gray image and pyramid of each copied frame, reused after the first lap
+   for(size_t i = 0; i < frames; i++) {
+      const Frame& frame = sources[i % sources.size()];
+
+      int64 t = cv::getTickCount();
+      history.Push(frame);
+      cost.reference.push_back(elapsed(t));
+
+      t = cv::getTickCount();
+      frame.image.copyTo(prevScene);
+      cost.copyImage.push_back(elapsed(t));
+
+      t = cv::getTickCount();
+      vector<Mat>& copy = ring[i % ring.size()];
+      const vector<Mat>& pyramid = frame.Pyramid(methods);
+      copy.resize(pyramid.size() + 2);
+      frame.image.copyTo(copy[0]);
+      frame.Gray().copyTo(copy[1]);
+      for(size_t k = 0; k < pyramid.size(); k++)
+         pyramid[k].copyTo(copy[k + 2]);
+      cost.copyFrame.push_back(elapsed(t));
+   }
+   return cost;
+}
+
+// each engine constructed on every call as the wrappers did before, against the wrapper that keeps it
+struct EngineCost {
+   string name;
+   vector<double> perCall;        // milliseconds of the construction and the run on each frame
+   vector<double> construction;   // milliseconds of the construction alone
+   vector<double> persistent;     // milliseconds of the run of the wrapper
+};
+
+// per call: the construction time of the OpenCV engines, then the detection and the extraction with them
+typedef std::function<double(const Mat&, vector<cv::KeyPoint>&, Mat&)> PerCallEngine;
+
+PerCallEngine perCall(const std::function<cv::FeatureDetector*()>& detector,
+                      const std::function<cv::DescriptorExtractor*()>& extractor) {
+   return [=](const Mat& gray, vector<cv::KeyPoint>& keys, Mat& descriptors) {
+      int64 t = cv::getTickCount();
+      SPtr<cv::FeatureDetector> detect = detector();
+      SPtr<cv::DescriptorExtractor> extract = extractor();
+      double construction = elapsed(t);
+      detect->detect(gray, keys);
+      extract->compute(gray, keys, descriptors);
+      return construction;
+   };
+}
+
+vector<EngineCost> engineCost(const string& video, size_t frames) {
+   struct Engine {
+      string name;
+      PerCallEngine perCall;
+      SPtr<FeatureDetector> detector;
+      SPtr<DescriptorExtractor> extractor;
+   };
+   // the same parameters of the wrappers (see Algorithms.cpp)
+   vector<Engine> engines = {
+      { "brisk", perCall(
+            []() { return new cv::BRISK(30, 3, 1.0f); }, []() { return new cv::BRISK(30, 3, 1.0f); }),
+         new BRISKDetector, new BRISKExtractor },
+      { "orb", perCall(
+            []() { return new cv::OrbFeatureDetector(500, 1.2f, 8, 31); },
+            []() { return new cv::OrbDescriptorExtractor(500, 1.2f, 8, 31, 0, 2, cv::ORB::HARRIS_SCORE, 31); }),
+         new ORBDetector(500), new ORBExtractor },
+      { "sift", perCall(
+            []() { return new cv::SiftFeatureDetector(0, 3, 0.04, 10, 1.6); }, []() { return new cv::SiftDescriptorExtractor; }),
+         new SIFTDetector, new SIFTExtractor },
+      { "surf", perCall(
+            []() { return new cv::SurfFeatureDetector(400.0, 4, 2); },
+            []() { return new cv::SurfDescriptorExtractor(400.0, 4, 2, false, false); }),
+         new SURFDetector, new SURFExtractor },
+   };
+
+   vector<EngineCost> costs(engines.size());
+   for(size_t e = 0; e < engines.size(); e++)
+      costs[e].name = engines[e].name;
+
+   cv::VideoCapture cap(video);
+   if(!cap.isOpened()) {
+      AVR_ERROR(Cod::Undefined, "It did not open the scene video");
+   }
+   Mat image, gray, descriptors;
+   vector<cv::KeyPoint> keys;
+   for(size_t i = 0; i < frames; i++) {
+      cap >> image;
+      if(image.empty()) break;
+      cv::cvtColor(image, gray, CV_BGR2GRAY);
+
+      for(size_t e = 0; e < engines.size(); e++) {
+         int64 t = cv::getTickCount();
+         costs[e].construction.push_back(engines[e].perCall(gray, keys, descriptors));
+         costs[e].perCall.push_back(elapsed(t));
+
+         t = cv::getTickCount();
+         (*engines[e].detector)(gray, keys);
+         (*engines[e].extractor)(gray, keys, descriptors);
+         costs[e].persistent.push_back(elapsed(t));
+      }
+   }
+   return costs;
+}
+
+// FindAll on a frame with many markers visible at once, with each number of threads of the OpenCV parallel loops
+struct ScalingCost {
+   int threads;
+   vector<double> find;     // milliseconds of FindAll
+   vector<double> frame;    // milliseconds of Update and FindAll
+   size_t located;          // markers located over all frames
+};
+
+const int SCALING_COLS = 4;
+const int SCALING_ROWS = 2;
+
+// the quadrants of both marker images are the markers, laid out on a 1920x1080 grid that moves a few pixels per frame
+vector<ScalingCost> scalingCost(const SystemAlgorithms& methods, const vector<Scene>& scenes, size_t frames, const vector<int>& threads) {
+   vector<Mat> images;
+   for(size_t s = 0; s < 2; s++) {
+      Mat gray = cv::imread(scenes[s].marker, cv::IMREAD_GRAYSCALE);
+      if(gray.empty()) {
+         AVR_ERROR(Cod::Undefined, "It did not read the marker image");
+      }
+      const int w = gray.cols/2, h = gray.rows/2;
+      for(int q = 0; q < 4; q++)
+         images.push_back(gray(cv::Rect(w * (q % 2), h * (q / 2), w, h)).clone());
+   }
+
+   const Size2i canvas(1920, 1080), cell(canvas.width / SCALING_COLS, canvas.height / SCALING_ROWS);
+   vector<Mat> scene(frames);
+   for(size_t i = 0; i < frames; i++) {
+      scene[i] = Mat(canvas, CV_8UC3, cv::Scalar::all(128));
+      const int dx = int(12 * std::sin(i * 0.1)), dy = int(8 * std::cos(i * 0.1));
+      for(size_t m = 0; m < images.size(); m++) {
+         const double scale = 0.8 * std::min(double(cell.width) / images[m].cols, double(cell.height) / images[m].rows);
+         Mat resized, color;
+         cv::resize(images[m], resized, cv::Size(), scale, scale, cv::INTER_AREA);
+         cv::cvtColor(resized, color, CV_GRAY2BGR);
+         const int x = cell.width * int(m % SCALING_COLS) + (cell.width - color.cols)/2 + dx;
+         const int y = cell.height * int(m / SCALING_COLS) + (cell.height - color.rows)/2 + dy;
+         color.copyTo(scene[i](cv::Rect(x, y, color.cols, color.rows)));
+      }
+   }
+
+   vector<ScalingCost> costs;
+   for(int n : threads) {
+      cv::setNumThreads(n);
+      ScalingCost cost;
+      cost.threads = n;
+      cost.located = 0;
+
+      HybridTracker tracker(methods);
+      vector<Marker> markers;
+      for(const auto& image : images) {
+         vector<cv::KeyPoint> keys;
+         MarkerFeatures features;
+         methods.DetectAndExtract(image, keys, features.descriptor);
+         cv::KeyPoint::convert(keys, features.keys);
+         features.size = image.size();
+         features.index = methods.Index(features.descriptor);
+         markers.push_back(tracker.Registry(features, nullptr));
+      }
+
+      FramePool pool;
+      for(size_t i = 0; i < frames; i++) {
+         Frame& frame = pool.Acquire();
+         scene[i].copyTo(frame.image);
+         frame.number = i;
+
+         int64 t = cv::getTickCount();
+         tracker.Update(frame);
+         double update = elapsed(t);
+         t = cv::getTickCount();
+         tracker.FindAll(markers, frame);
+         cost.find.push_back(elapsed(t));
+         cost.frame.push_back(update + cost.find.back());
+
+         for(auto& marker : markers) {
+            marker.SetLost(marker.GetMatches().size() <= 20);
+            if(!marker.Lost()) cost.located++;
+         }
+      }
+      costs.push_back(cost);
+   }
+   cv::setNumThreads(-1);
+   return costs;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+   string data = "../data", output;
+   vector<string> synthetic;
+   size_t maxFrames = size_t(-1);
+
+   for(int i = 1; i < argc; i++) {
+      string arg = argv[i];
+      bool value = i + 1 < argc;
+      if(arg == "-d" && value)      data = argv[++i];
+      else if(arg == "-g" && value) synthetic.push_back(argv[++i]);
+      else if(arg == "-n" && value) maxFrames = std::strtoul(argv[++i], nullptr, 10);
+      else if(arg == "-o" && value) output = argv[++i];
+      else {
+         cerr << "Usage: " << argv[0] << " [-d <data dir>] [-g <synthetic dir>]... [-n <max frames>] [-o <output.json>]\n";
+         return 1;
+      }
+   }
+
+   // the three presets of SystemAlgorithms::Create and the binary combinations not covered by them
+   const vector<Config> configs = {
+      { "balanced",    []() { return SystemAlgorithms::Create(true, true); } },
+      { "performance", []() { return SystemAlgorithms::Create(true, false); } },
+      { "quality",     []() { return SystemAlgorithms::Create(false, true); } },
+      { "orb",         []() { return SystemAlgorithms(new ORBDetector(500), new ORBExtractor, new HammingMatcher, new LucasKanadeAlgorithm); } },
+      { "brisk",       []() { return SystemAlgorithms(new BRISKDetector, new BRISKExtractor, new HammingMatcher, new LucasKanadeAlgorithm); } },
+      { "fast-brief",  []() { return SystemAlgorithms(new FASTDetector(20), new BRIEFExtractor, new HammingMatcher, new LucasKanadeAlgorithm); } },
+      { "surf-flann",  []() { return SystemAlgorithms(new SURFDetector, new SURFExtractor, new FlannBasedMatcher, new LucasKanadeAlgorithm); } },
+      { "orb-lsh",     []() { return SystemAlgorithms(new ORBDetector(500), new ORBExtractor, new FlannBasedMatcher, new LucasKanadeAlgorithm); } },
+      // the FLANN k-d forest and LSH index built on every detected frame, against the persistent ones above
+      { "surf-flann-reindex", []() { return SystemAlgorithms(new SURFDetector, new SURFExtractor, new FlannBasedMatcher, new LucasKanadeAlgorithm); }, true },
+      { "orb-lsh-reindex",    []() { return SystemAlgorithms(new ORBDetector(500), new ORBExtractor, new FlannBasedMatcher, new LucasKanadeAlgorithm); }, true },
+      // without the motion model, and with the localization on the worker thread
+      { "balanced-nomotion",  []() { return SystemAlgorithms::Create(true, true); }, false, true },
+      { "balanced-async",     []() { return SystemAlgorithms::Create(true, true); }, false, false, true },
+      // the same detectors on a 4x4 grid of tiles, detected in parallel with a budget per tile
+      { "orb-tiled",        []() { return SystemAlgorithms(new TiledDetector(new ORBDetector(500)), new ORBExtractor, new HammingMatcher, new LucasKanadeAlgorithm); } },
+      { "fast-brief-tiled", []() { return SystemAlgorithms(new TiledDetector(new FASTDetector(20)), new BRIEFExtractor, new HammingMatcher, new LucasKanadeAlgorithm); } },
+      // the balanced preset with 300 keypoints per frame chosen by each policy of KeypointBudget
+      { "balanced-response", []() { return SystemAlgorithms(SystemAlgorithms::Create(true, true), KeypointBudget(300, KeypointBudget::RESPONSE)); } },
+      { "balanced-anms",     []() { return SystemAlgorithms(SystemAlgorithms::Create(true, true), KeypointBudget(300, KeypointBudget::ANMS)); } },
+      { "balanced-grid",     []() { return SystemAlgorithms(SystemAlgorithms::Create(true, true), KeypointBudget(300, KeypointBudget::GRID)); } },
+   };
+   vector<Scene> scenes = {
+      { "cormem", data + "/cormem_scene.mp4", data + "/cormem_object.jpg", data + "/camera.yml", "" },
+      { "rabin",  data + "/rabin_scene.mp4",  data + "/rabin_object.jpg",  data + "/camera.yml", "" },
+   };
+   for(const auto& dir : synthetic) {
+      // the name is a JSON string, so the Windows separators are replaced
+      string name = dir;
+      std::replace(name.begin(), name.end(), '\\', '/');
+      scenes.push_back({ name, dir + "/frame_%05d.png", dir + "/marker.png", dir + "/camera.yml", dir + "/groundtruth.bin" });
+   }
+
+   std::ostringstream json;
+   json << "{\n  \"configs\": [";
+   for(size_t c = 0; c < configs.size(); c++) {
+      SystemAlgorithms methods = configs[c].create();
+      json << (c ? "," : "") << "\n    {\"name\": \"" << configs[c].name << "\", \"scenes\": [";
+
+      for(size_t s = 0; s < scenes.size(); s++) {
+         cerr << configs[c].name << " / " << scenes[s].name << "\n";
+         Result result = replay(methods, configs[c], scenes[s], maxFrames);
+
+         json << (s ? "," : "") << "\n      {\"name\": \"" << scenes[s].name << "\", \"frames\": " << result.frames
+              << ", \"lost_ratio\": " << (double(result.lost) / std::max<size_t>(result.frames, 1))
+              << ", \"extraction_ratio\": " << (double(result.extractions) / std::max<size_t>(result.frames, 1)) << ",";
+         for(int k = 0; k < STAGES; k++) {
+            json << "\n       \"" << STAGE_NAMES[k] << "\": ";
+            summary(json, result.stages[k]);
+            json << ",";
+         }
+         json << "\n       \"frame\": ";
+         summary(json, result.frameTimes);
+         json << ",\n       \"inliers\": ";
+         summary(json, result.inliers);
+         if(!scenes[s].truth.empty()) {
+            json << ",\n       \"recall\": " << (double(result.cornerError.size()) / std::max<size_t>(result.visible, 1))
+                 << ",\n       \"corner_error\": ";
+            summary(json, result.cornerError);
+            const char* methodNames[2] = { "pnp", "app" };
+            for(int k = 0; k < 2; k++) {
+               json << ",\n       \"" << methodNames[k] << "_rotation_error\": ";
+               summary(json, result.rotationError[k]);
+               json << ",\n       \"" << methodNames[k] << "_translation_error\": ";
+               summary(json, result.translationError[k]);
+            }
+         }
+         if(!result.probes.empty()) {
+            json << ",\n       \"probes\": {";
+            for(size_t k = 0; k < result.probes.size(); k++) {
+               const ProbeStats& probe = result.probes[k];
+               json << (k ? ", " : "") << "\n        \"" << probe.name << "\": {\"count\": " << probe.count
+                    << ", \"counter\": " << probe.counter << ", \"mean\": " << probe.mean << ", \"p50\": " << probe.p50
+                    << ", \"p95\": " << probe.p95 << ", \"p99\": " << probe.p99 << "}";
+            }
+            json << "}";
+         }
+         json << "}";
+      }
+      json << "\n    ]}";
+   }
+   json << "\n  ]";
+
+   const size_t HISTORY_FRAMES = 300;
+   cerr << "history 1080p\n";
+   HistoryCost history = historyCost(SystemAlgorithms::Create(true, true), std::min(maxFrames, HISTORY_FRAMES));
+   double copied = 0.0;
+   for(double ms : history.copyFrame) copied += ms;
+   json << ",\n  \"history_1080p\": {\"image_mb\": " << history.imageBytes / 1048576.0
+        << ", \"frame_mb\": " << history.frameBytes / 1048576.0
+        << ", \"copy_frame_gbps\": " << (history.frameBytes * history.copyFrame.size() / 1e6) / std::max(copied, 1e-9) << ",";
+   json << "\n   \"reference\": ";
+   summary(json, history.reference);
+   json << ",\n   \"copy_image\": ";
+   summary(json, history.copyImage);
+   json << ",\n   \"copy_frame\": ";
+   summary(json, history.copyFrame);
+   json << "}";
+
+   const size_t ENGINE_FRAMES = 100;
+   cerr << "engines / cormem\n";
+   vector<EngineCost> engines = engineCost(scenes[0].video, std::min(maxFrames, ENGINE_FRAMES));
+   json << ",\n  \"engines_cormem\": [";
+   for(size_t e = 0; e < engines.size(); e++) {
+      json << (e ? "," : "") << "\n    {\"name\": \"" << engines[e].name << "\",\n     \"per_call\": ";
+      summary(json, engines[e].perCall);
+      json << ",\n     \"construction\": ";
+      summary(json, engines[e].construction);
+      json << ",\n     \"persistent\": ";
+      summary(json, engines[e].persistent);
+      json << "}";
+   }
+   json << "\n  ]";
+
+   // up to the cores of the machine, the speedup is relative to a single thread
+   const size_t SCALING_FRAMES = 200;
+   vector<int> threads = { 1, 2, 4, 8 };
+   const int cores = cv::getNumberOfCPUs();
+   threads.erase(std::remove_if(threads.begin(), threads.end(), [=](int n) { return n > cores; }), threads.end());
+   if(threads.back() != cores) threads.push_back(cores);
+   cerr << "scaling / " << SCALING_COLS * SCALING_ROWS << " markers\n";
+   vector<ScalingCost> scaling = scalingCost(SystemAlgorithms::Create(true, true), scenes, std::min(maxFrames, SCALING_FRAMES), threads);
+   vector<double> single = scaling[0].find;
+   std::sort(single.begin(), single.end());
+   json << ",\n  \"scaling_findall\": {\"markers\": " << SCALING_COLS * SCALING_ROWS << ", \"runs\": [";
+   for(size_t k = 0; k < scaling.size(); k++) {
+      vector<double> find = scaling[k].find;
+      std::sort(find.begin(), find.end());
+      json << (k ? "," : "") << "\n    {\"threads\": " << scaling[k].threads
+           << ", \"located_ratio\": " << double(scaling[k].located) / std::max<size_t>(SCALING_COLS * SCALING_ROWS * find.size(), 1)
+           << ", \"speedup\": " << percentile(single, 50) / std::max(percentile(find, 50), 1e-9) << ",\n     \"find\": ";
+      summary(json, scaling[k].find);
+      json << ",\n     \"frame\": ";
+      summary(json, scaling[k].frame);
+      json << "}";
+   }
+   json << "\n  ]}\n}\n";
+
+   if(output.empty()) {
+      cout << json.str();
+   } else {
+      std::ofstream file(output.c_str());
+      file << json.str();
+      if(!file.good()) {
+         cerr << "It did not write " << output << "\n";
+         return 1;
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,49 @@
+/**
+ * Offline tool to build a marker database file (see avr::MarkerFile)
+ *
+ * Usage: AVRMarkerDB <output file> <balanced|performance|quality> <marker image> [<marker image> ...]
+ * The optimization mode selects the same algorithms of Application::Builder::optimize, the application must use it too.
+ */
+#include <iostream>
+#include <cstring>
+
+#include <opencv2/core/core.hpp>
+
+#include <avr/track/Tracking.hpp>
+#include <avr/track/MarkerFile.hpp>
+
+using namespace avr;
+
+using std::cout;
+using std::cerr;
+
+int main(int argc, char** argv) {
+   if(argc < 4) {
+      cerr << "Usage: " << argv[0] << " <output file> <balanced|performance|quality> <marker image> [<marker image> ...]\n";
+      return 1;
+   }
+
+   bool performance = std::strcmp(argv[2], "performance") == 0;
+   bool quality = std::strcmp(argv[2], "quality") == 0;
+   if(!performance and !quality and std::strcmp(argv[2], "balanced") != 0) {
+      cerr << "Unknown optimization mode " << argv[2] << "\n";
+      return 1;
+   }
+
+   SystemAlgorithms methods = SystemAlgorithms::Create(performance, quality);
+   HybridTracker tracker(methods);
+
+   vector<Marker> markers;
+   for(int i = 3; i < argc; i++) {
+      double time = (double) cv::getTickCount();
+      markers.push_back(tracker.Registry(PreMarker(argv[i], nullptr)));
+      time = ((double) cv::getTickCount() - time) / cv::getTickFrequency();
+      cout << argv[i] << ": " << markers.back().GetSize().width << "x" << markers.back().GetSize().height
+           << " registered in " << time << "s\n";
+   }
+
+   MarkerFile::Write(argv[1], markers, methods);
+   cout << markers.size() << " markers written to " << argv[1] << "\n";
+
+   return 0;
+}
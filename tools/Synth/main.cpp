@@ -0,0 +1,293 @@
+/**
+ * Synthetic ground truth generator, it warps a marker image over background textures with known homography and pose
+ *
+ * Usage: AVRSynth [options] <marker image> <output dir>
+ *    -c <file>      camera calibration file, only its intrinsics are used (default is ../data/camera.yml)
+ *    -n <frames>    number of frames (default is 600)
+ *    -p <profile>   pan|zoom|rotation|blur|occlusion|mixed, the frames are split evenly among the given profiles
+ *                   in order, mixed is all the others in sequence (default is mixed)
+ *    -b <image>     background texture (repeatable), each profile uses the next one (default is a procedural texture)
+ *    -s <seed>      random seed of the textures, occluders and noise (default is 0)
+ *
+ * The output directory receives the frames frame_%05d.png, the marker image marker.png, the camera file camera.yml
+ * without lens distortion (the frames are rendered by a pinhole camera) and the ground truth groundtruth.bin
+ * (see avr::GroundTruth). The sequence is read by AVRBenchmark -g <dir> and AVRBatch -g.
+ */
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <avr/track/GroundTruth.hpp>
+
+using namespace avr;
+
+using std::cout;
+using std::cerr;
+using std::string;
+
+namespace {
+
+enum Profile { PAN, ZOOM, ROTATION, BLUR, OCCLUSION, PROFILES };
+const char* PROFILE_NAMES[PROFILES] = { "pan", "zoom", "rotation", "blur", "occlusion" };
+
+const double PI = 3.14159265358979323846;
+
+struct Motion {
+   double rx, ry, rz;   // radians
+   double tx, ty, tz;   // marker pixels
+};
+
+// rotation Rz * Ry * Rx
+cv::Matx33d rotation(double rx, double ry, double rz) {
+   cv::Matx33d Rx(1, 0, 0, 0, std::cos(rx), -std::sin(rx), 0, std::sin(rx), std::cos(rx));
+   cv::Matx33d Ry(std::cos(ry), 0, std::sin(ry), 0, 1, 0, -std::sin(ry), 0, std::cos(ry));
+   cv::Matx33d Rz(std::cos(rz), -std::sin(rz), 0, std::sin(rz), std::cos(rz), 0, 0, 0, 1);
+   return Rz * Ry * Rx;
+}
+
+/**
+ * Motion of a profile at t in [0, 1), the distance z0 fits the marker in about half of the frame width
+ * and (sx, sy) are the lateral offsets at z0 that keep the marker inside the frame
+ */
+Motion motion(Profile profile, double t, double z0, double sx, double sy) {
+   Motion m = { 0.0, 0.0, 0.0, 0.0, 0.0, z0 };
+   double w = 2.0 * PI * t;
+   switch(profile) {
+   case PAN:
+      m.tx = sx * std::sin(w);
+      m.ty = sy * std::sin(2.0 * w);
+      m.ry = 0.15 * std::sin(w);
+      break;
+   case ZOOM:
+      m.tz = z0 * (1.0 + 0.6 * std::sin(w));
+      m.rx = 0.1 * std::sin(3.0 * w);
+      break;
+   case ROTATION:
+      m.rz = w;
+      m.rx = 0.6 * std::sin(w);
+      m.ry = 0.6 * std::cos(w);
+      m.tz = z0 * 1.2;
+      break;
+   case BLUR:
+      // faster pan, the motion blur comes from its image speed
+      m.tx = sx * std::sin(3.0 * w);
+      m.ty = 0.5 * sy * std::cos(3.0 * w);
+      break;
+   case OCCLUSION:
+      m.tx = 0.3 * sx * std::sin(w);
+      m.rz = 0.2 * std::sin(w);
+      break;
+   default:
+      break;
+   }
+   return m;
+}
+
+Mat texture(const Size2i& size, cv::RNG& rng) {
+   Mat out(size, CV_8UC3);
+   rng.fill(out, cv::RNG::UNIFORM, 0, 255);
+   cv::GaussianBlur(out, out, cv::Size(0, 0), 6.0);
+   // clutter with edges and corners, so the detectors also find features outside the marker
+   for(int i = 0; i < 60; i++) {
+      cv::Scalar color(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255));
+      Point2f p(rng.uniform(0, size.width), rng.uniform(0, size.height));
+      if(i % 2)
+         cv::rectangle(out, p, p + Point2f(rng.uniform(10, 120), rng.uniform(10, 120)), color, -1);
+      else
+         cv::circle(out, p, rng.uniform(5, 60), color, -1);
+   }
+   return out;
+}
+
+// blurs the image along the motion (dx, dy) in pixels
+void motionBlur(Mat& image, double dx, double dy) {
+   int length = int(std::sqrt(dx*dx + dy*dy) + 0.5);
+   if(length < 2) return;
+   Mat kernel = Mat::zeros(length, length, CV_32F);
+   Point2f center((length - 1) / 2.0f, (length - 1) / 2.0f), step(dx / length, dy / length);
+   for(int i = 0; i < length; i++) {
+      Point2f p = center + step * float(i - length / 2);
+      int x = std::min(std::max(cvRound(p.x), 0), length - 1), y = std::min(std::max(cvRound(p.y), 0), length - 1);
+      kernel.at<float>(y, x) += 1.0f;
+   }
+   kernel /= cv::sum(kernel)[0];
+   cv::filter2D(image, image, -1, kernel);
+}
+
+int usage(const char* name) {
+   cerr << "Usage: " << name << " [-c <camera file>] [-n <frames>] [-p pan|zoom|rotation|blur|occlusion|mixed]... "
+        << "[-b <background>]... [-s <seed>] <marker image> <output dir>\n";
+   return 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+   string cameraFile = "../data/camera.yml";
+   vector<string> backgrounds, args;
+   vector<Profile> profiles;
+   size_t frames = 600;
+   uint64 seed = 0;
+
+   for(int i = 1; i < argc; i++) {
+      string arg = argv[i];
+      bool value = i + 1 < argc;
+      if(arg == "-c" && value)      cameraFile = argv[++i];
+      else if(arg == "-n" && value) frames = std::strtoul(argv[++i], nullptr, 10);
+      else if(arg == "-b" && value) backgrounds.push_back(argv[++i]);
+      else if(arg == "-s" && value) seed = std::strtoull(argv[++i], nullptr, 10);
+      else if(arg == "-p" && value) {
+         string name = argv[++i];
+         size_t p = 0;
+         while(p < PROFILES && name != PROFILE_NAMES[p]) p++;
+         if(p < PROFILES) profiles.push_back(Profile(p));
+         else if(name == "mixed") for(p = 0; p < PROFILES; p++) profiles.push_back(Profile(p));
+         else return usage(argv[0]);
+      }
+      else if(arg[0] == '-') return usage(argv[0]);
+      else args.push_back(arg);
+   }
+   if(args.size() != 2 || frames == 0) return usage(argv[0]);
+   if(profiles.empty())
+      for(size_t p = 0; p < PROFILES; p++) profiles.push_back(Profile(p));
+
+   Mat marker = cv::imread(args[0], cv::IMREAD_COLOR);
+   if(marker.empty()) {
+      cerr << "It did not read the marker image " << args[0] << "\n";
+      return 1;
+   }
+   const string dir = args[1];
+
+   // only the intrinsics are used, the frames have no lens distortion
+   cv::FileStorage reader(cameraFile, cv::FileStorage::READ);
+   if(!reader.isOpened()) {
+      cerr << "It did not read the camera file " << cameraFile << "\n";
+      return 1;
+   }
+   Size2i size;
+   Mat intrinsics;
+   reader["image_width"] >> size.width;
+   reader["image_height"] >> size.height;
+   reader["camera_matrix"] >> intrinsics;
+   cv::Matx33d K = intrinsics;
+   {
+      cv::FileStorage writer(dir + "/camera.yml", cv::FileStorage::WRITE);
+      writer << "image_width" << size.width << "image_height" << size.height
+             << "camera_matrix" << intrinsics << "distortion_coefficients" << Mat::zeros(5, 1, CV_64F);
+   }
+   if(!cv::imwrite(dir + "/marker.png", marker)) {
+      cerr << "It did not write to the output directory " << dir << "\n";
+      return 1;
+   }
+
+   cv::RNG rng(seed);
+   vector<Mat> textures;
+   for(size_t p = 0; p < profiles.size(); p++) {
+      if(backgrounds.empty()) {
+         textures.push_back(texture(size, rng));
+      } else {
+         Mat bg = cv::imread(backgrounds[p % backgrounds.size()], cv::IMREAD_COLOR);
+         if(bg.empty()) {
+            cerr << "It did not read the background " << backgrounds[p % backgrounds.size()] << "\n";
+            return 1;
+         }
+         cv::resize(bg, bg, size);
+         textures.push_back(bg);
+      }
+   }
+
+   // the marker is centered at the origin of its plane, as the world points given to Camera::Pose
+   const double cx = marker.cols / 2.0, cy = marker.rows / 2.0;
+   const cv::Matx33d center(1, 0, -cx, 0, 1, -cy, 0, 0, 1);
+   const double z0 = K(0, 0) * marker.cols / (0.45 * size.width);
+   const double sx = 0.25 * size.width * z0 / K(0, 0), sy = 0.2 * size.height * z0 / K(1, 1);
+
+   const Coords2D world = { Point2f(0, 0), Point2f(marker.cols, 0), Point2f(marker.cols, marker.rows), Point2f(0, marker.rows) };
+   const Mat ones(marker.size(), CV_8U, cv::Scalar(255));
+
+   GroundTruth truth;
+   truth.markerSize = marker.size();
+   truth.frameSize = size;
+
+   Mat frame, markerMask, occluder, noise;
+   Point2f lastCenter;
+   char name[32];
+   for(size_t i = 0; i < frames; i++) {
+      size_t segment = i * profiles.size() / frames;
+      size_t begin = (segment * frames + profiles.size() - 1) / profiles.size();
+      size_t end = ((segment + 1) * frames + profiles.size() - 1) / profiles.size();
+      Profile profile = profiles[segment];
+      Motion m = motion(profile, double(i - begin) / std::max<size_t>(end - begin, 1), z0, sx, sy);
+
+      cv::Matx33d R = rotation(m.rx, m.ry, m.rz);
+      cv::Matx33d Rt(R(0, 0), R(0, 1), m.tx, R(1, 0), R(1, 1), m.ty, R(2, 0), R(2, 1), m.tz);
+      cv::Matx33d H = K * Rt * center;
+      H = H * (1.0 / H(2, 2));
+
+      GroundTruthRecord rec;
+      std::memset(&rec, 0, sizeof(rec));
+      rec.frame = uint32_t(i);
+      for(int k = 0; k < 9; k++) rec.homography[k] = H(k / 3, k % 3);
+      for(int k = 0; k < 12; k++) rec.pose[k] = (k % 4 == 3) ? (k == 3 ? m.tx : k == 7 ? m.ty : m.tz) : R(k / 4, k % 4);
+      rec.pose[15] = 1.0;
+
+      Coords2D corners;
+      cv::perspectiveTransform(world, corners, Mat(H));
+      rec.visible = 1;
+      for(size_t k = 0; k < 4; k++) {
+         rec.corners[2*k] = corners[k].x;
+         rec.corners[2*k + 1] = corners[k].y;
+         if(corners[k].x < 0 || corners[k].y < 0 || corners[k].x >= size.width || corners[k].y >= size.height)
+            rec.visible = 0;
+      }
+
+      textures[segment].copyTo(frame);
+      cv::warpPerspective(marker, frame, Mat(H), size, cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+
+      Point2f centerPt = (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25f;
+      if(profile == BLUR && i > begin)
+         motionBlur(frame, centerPt.x - lastCenter.x, centerPt.y - lastCenter.y);
+      lastCenter = centerPt;
+
+      if(profile == OCCLUSION) {
+         // a bar sweeps the marker from left to right
+         double t = double(i - begin) / std::max<size_t>(end - begin, 1);
+         cv::Rect bounds = cv::boundingRect(corners);
+         int width = bounds.width / 3;
+         int x = bounds.x - width + int(t * (bounds.width + width));
+         occluder = Mat::zeros(size, CV_8U);
+         cv::rectangle(occluder, cv::Point(x, bounds.y - 20), cv::Point(x + width, bounds.y + bounds.height + 20), cv::Scalar(255), -1);
+         textures[(segment + 1) % textures.size()].copyTo(frame, occluder);
+
+         cv::warpPerspective(ones, markerMask, Mat(H), size, cv::INTER_NEAREST);
+         double area = cv::countNonZero(markerMask);
+         cv::bitwise_and(markerMask, occluder, markerMask);
+         rec.occlusion = float(area > 0 ? cv::countNonZero(markerMask) / area : 0.0);
+      }
+
+      // sensor noise
+      noise.create(size, CV_16SC3);
+      rng.fill(noise, cv::RNG::NORMAL, 0, 3);
+      frame.convertTo(frame, CV_16SC3);
+      frame += noise;
+      frame.convertTo(frame, CV_8UC3);
+
+      std::sprintf(name, "/frame_%05u.png", unsigned(i));
+      if(!cv::imwrite(dir + name, frame)) {
+         cerr << "It did not write the frame " << dir + name << "\n";
+         return 1;
+      }
+      truth.Add(rec);
+   }
+
+   truth.Write(dir + "/groundtruth.bin");
+   cout << frames << " frames written to " << dir << "\n";
+   return 0;
+}